@@ -89,6 +89,14 @@ void TextWindow::ScreenChangeCheckClosedContour(int link, uint32_t v) {
     InvalidateGraphics();
 }
 
+void TextWindow::ScreenChangeCountMemoryUsage(int link, uint32_t v) {
+    MemoryUsage::Enable(!MemoryUsage::IsEnabled());
+}
+
+void TextWindow::ScreenResetMemoryPeaks(int link, uint32_t v) {
+    MemoryUsage::ResetPeaks();
+}
+
 void TextWindow::ScreenChangeShadedTriangles(int link, uint32_t v) {
     SS.exportShadedTriangles = !SS.exportShadedTriangles;
     InvalidateGraphics();
@@ -303,6 +311,22 @@ void TextWindow::ShowConfiguration() {
     Printf(false, "%Ba   %d %Fl%Ll%f[change]%E",
         SS.autosaveInterval, &ScreenChangeAutosaveInterval);
 
+    Printf(false, "");
+    Printf(false, "  %Fd%f%Ll%s  count memory usage%E",
+        &ScreenChangeCountMemoryUsage,
+        MemoryUsage::IsEnabled() ? CHECK_TRUE : CHECK_FALSE);
+    if(MemoryUsage::IsEnabled()) {
+        Printf(false, "%Ft memory used for  current        peak%E");
+        for(i = 0; i < MemoryUsage::TAGS; i++) {
+            MemoryTag tag = (MemoryTag)i;
+            Printf(false, "%Bp   %s", (i & 1) ? 'd' : 'a',
+                ssprintf("%-10s %11s %11s", MemoryUsage::TagName(tag),
+                    MemoryUsage::FormatBytes(MemoryUsage::Current(tag)).c_str(),
+                    MemoryUsage::FormatBytes(MemoryUsage::Peak(tag)).c_str()).c_str());
+        }
+        Printf(false, "%Ba   %Fl%Ll%f[reset peaks]%E", &ScreenResetMemoryPeaks);
+    }
+
     if(canvas) {
         const char *gl_vendor, *gl_renderer, *gl_version;
         canvas->GetIdent(&gl_vendor, &gl_renderer, &gl_version);
@@ -808,6 +808,8 @@ void GraphicsWindow::Draw(Canvas *canvas) {
 void GraphicsWindow::Paint() {
     if(!canvas) return;
 
+    MemoryTagScope tag(MemoryTag::RENDER);
+
     havePainted = true;
 
     int w, h;
@@ -267,14 +267,54 @@ public:
 };
 
 // A list, where each element has an integer identifier. The list is kept
-// sorted by that identifier, and items can be looked up in log n time by
-// id.
+// sorted by that identifier; and once it's big enough, it also keeps a hash
+// table of the identifiers, so that items can be looked up in constant time
+// by id.
 template <class T, class H>
 class IdList {
 public:
     T     *elem;
     int   n;
     int   elemsAllocated;
+    // Whether items have been added with AddUnsorted() since the last Sort();
+    // if so, nothing can be looked up until it's sorted again.
+    bool  unsorted;
+
+    // An open-addressed hash table from each id to its index in elem, with
+    // -1 where empty; its size is a power of two, and it's at most half full.
+    // It's empty if the list is too short to be worth it.
+    std::vector<int> index;
+
+    enum { MIN_INDEXED = 16 };
+
+    static size_t HashId(uint32_t v) {
+        v ^= v >> 16;
+        v *= 0x85ebca6bU;
+        v ^= v >> 13;
+        v *= 0xc2b2ae35U;
+        v ^= v >> 16;
+        return v;
+    }
+
+    void IndexInsert(int i) {
+        size_t mask = index.size() - 1;
+        size_t k = HashId(elem[i].h.v) & mask;
+        while(index[k] >= 0) k = (k + 1) & mask;
+        index[k] = i;
+    }
+
+    void BuildIndex() {
+        if(n < MIN_INDEXED) {
+            index.clear();
+            return;
+        }
+        size_t size = 64;
+        while(size < 2 * (size_t)n) size *= 2;
+        index.assign(size, -1);
+        for(int i = 0; i < n; i++) {
+            IndexInsert(i);
+        }
+    }
 
     uint32_t MaximumId() {
         if(n == 0) {
@@ -305,12 +345,16 @@ public:
     }
 
     void Add(T *t) {
+        ssassert(!unsorted, "List must be sorted before adding");
         if(n >= elemsAllocated) {
             ReserveMore((elemsAllocated + 32)*2 - n);
         }
-    
+
         int first = 0, last = n;
-        // We know that we must insert within the closed interval [first,last]
+        // Usually the new id is bigger than all the others, so check that
+        // first; otherwise, we know that we must insert within the closed
+        // interval [first,last].
+        if(n > 0 && elem[n - 1].h.v < t->h.v) first = n;
         while(first != last) {
             int mid = (first + last)/2;
             H hm = elem[mid].h;
@@ -327,6 +371,49 @@ public:
         std::move_backward(elem + i, elem + n, elem + n + 1);
         elem[i] = *t;
         n++;
+
+        if(index.empty() || index.size() < 2 * (size_t)n) {
+            BuildIndex();
+        } else {
+            // Everything after the new item moved up one. Going from the
+            // end, the old index of each is still unique in the table.
+            size_t mask = index.size() - 1;
+            for(int j = n - 1; j > i; j--) {
+                size_t k = HashId(elem[j].h.v) & mask;
+                while(index[k] != j - 1) k = (k + 1) & mask;
+                index[k] = j;
+            }
+            IndexInsert(i);
+        }
+    }
+
+    // Add an item at the end, without keeping the list sorted, when adding
+    // many items at once; the list mustn't be used for anything else until
+    // Sort() is called.
+    void AddUnsorted(T *t) {
+        if(n >= elemsAllocated) {
+            ReserveMore((elemsAllocated + 32)*2 - n);
+        }
+        new(&elem[n]) T(*t);
+        n++;
+        unsorted = true;
+    }
+
+    // Sort the list again after AddUnsorted(). The items that were already
+    // in order stay where they are, and the rest are sorted and merged in.
+    void Sort() {
+        int i = 1;
+        while(i < n && elem[i - 1].h.v < elem[i].h.v) i++;
+        if(i < n) {
+            auto byId = [](const T &a, const T &b) { return a.h.v < b.h.v; };
+            std::sort(elem + i, elem + n, byId);
+            std::inplace_merge(elem, elem + i, elem + n, byId);
+            for(int j = 1; j < n; j++) {
+                ssassert(elem[j - 1].h.v != elem[j].h.v, "Handle isn't unique");
+            }
+        }
+        unsorted = false;
+        BuildIndex();
     }
 
     T *FindById(H h) {
@@ -336,6 +423,15 @@ public:
     }
 
     int IndexOf(H h) {
+        ssassert(!unsorted, "List must be sorted before looking up");
+        if(!index.empty()) {
+            size_t mask = index.size() - 1;
+            for(size_t k = HashId(h.v) & mask; index[k] >= 0; k = (k + 1) & mask) {
+                if(elem[index[k]].h.v == h.v) return index[k];
+            }
+            return -1;
+        }
+
         int first = 0, last = n-1;
         while(first <= last) {
             int mid = (first + last)/2;
@@ -352,19 +448,8 @@ public:
     }
 
     T *FindByIdNoOops(H h) {
-        int first = 0, last = n-1;
-        while(first <= last) {
-            int mid = (first + last)/2;
-            H hm = elem[mid].h;
-            if(hm.v > h.v) {
-                last = mid-1; // and first stays the same
-            } else if(hm.v < h.v) {
-                first = mid+1; // and last stays the same
-            } else {
-                return &(elem[mid]);
-            }
-        }
-        return NULL;
+        int i = IndexOf(h);
+        return (i >= 0) ? &(elem[i]) : NULL;
     }
 
     T *First() {
@@ -415,6 +500,7 @@ public:
             elem[i].~T();
         n = dest;
         // and elemsAllocated is untouched, because we didn't resize
+        BuildIndex();
     }
     void RemoveById(H h) {
         ClearTags();
@@ -424,9 +510,11 @@ public:
 
     void MoveSelfInto(IdList<T,H> *l) {
         l->Clear();
-        *l = *this;
+        *l = std::move(*this);
         elemsAllocated = n = 0;
         elem = NULL;
+        unsorted = false;
+        index.clear();
     }
 
     void DeepCopyInto(IdList<T,H> *l) {
@@ -436,6 +524,8 @@ public:
             new(&l->elem[i]) T(elem[i]);
         l->elemsAllocated = elemsAllocated;
         l->n = n;
+        l->unsorted = unsorted;
+        l->index = index;
     }
 
     void Clear() {
@@ -446,6 +536,8 @@ public:
         elemsAllocated = n = 0;
         if(elem) MemFree(elem);
         elem = NULL;
+        unsorted = false;
+        index.clear();
     }
 
 };
@@ -466,6 +558,51 @@ public:
     void Solve();
 };
 
+// The memory that a vector holds on to, whether it's used or not.
+template<class T>
+size_t CapacityBytes(const std::vector<T> &v) {
+    return v.capacity() * sizeof(T);
+}
+
+// A sparse symmetric positive semi-definite matrix, factored as L*D*L'. We
+// eliminate in natural order; any pivot that's too small is taken to mean
+// that its row is a linear combination of the rows before it, so it gets
+// dropped (its D is zero) instead of making the factorization fail.
+class SparseSymmetricMatrix {
+public:
+    int                 n;
+
+    // The lower triangle, including the diagonal, stored by row. The
+    // entries of row i are at rowStart[i] to rowStart[i+1]-1, sorted by
+    // column, so the diagonal element always comes last.
+    std::vector<int>    rowStart;
+    std::vector<int>    col;
+    std::vector<double> val;
+
+    // The elimination tree, and L (unit diagonal, not stored) by column.
+    std::vector<int>    parent;
+    std::vector<int>    lStart;
+    std::vector<int>    lCount;
+    std::vector<int>    lRow;
+    std::vector<double> lVal;
+    std::vector<double> d;
+    int                 zeroPivots;
+
+    // Scratch space for InverseQuadraticForm.
+    std::vector<double> work;
+    std::vector<int>    reach;
+    std::vector<int>    visited;
+
+    void Analyze();
+    void Factor(double pivotTol);
+    void Solve(double *x) const;
+    void NullVector(int i, double *y) const;
+    double InverseQuadraticForm(const std::vector<int> &xRow,
+                                const std::vector<double> &xVal);
+
+    size_t MemoryUsed() const;
+};
+
 #define RGBi(r, g, b) RgbaColor::From((r), (g), (b))
 #define RGBf(r, g, b) RgbaColor::FromFloat((float)(r), (float)(g), (float)(b))
 
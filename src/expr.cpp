@@ -211,13 +211,87 @@ Expr *ExprQuaternion::Magnitude() const {
 }
 
 
-Expr *Expr::From(hParam p) {
+//-----------------------------------------------------------------------------
+// Expressions are hash-consed: when we're asked for one that's identical to
+// one that we've already built, we return that one instead. So subtrees that
+// are structurally identical are also identical as pointers, which saves
+// memory, and lets the simplification rules below spot e.g. x - x. This
+// means that an expression must never be modified once it's built.
+//
+// The table is open-addressed, with a power of two size; and it refers to
+// temporary memory, so it's forgotten along with that. Each thread has its
+// own temporary heap, so it has its own table too.
+//-----------------------------------------------------------------------------
+static thread_local std::vector<Expr *> SharedExprs;
+static thread_local size_t SharedExprCount;
+
+static uint64_t HashExpr(const Expr *e) {
+    uint64_t h;
+    memcpy(&h, &e->v, sizeof(h));
+    h ^= (uint64_t)(uintptr_t)e->a * 0x9e3779b97f4a7c15ULL;
+    h ^= (uint64_t)e->op << 48;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static bool SameExpr(const Expr *x, const Expr *y) {
+    return x->op == y->op && x->a == y->a &&
+           memcmp(&x->v, &y->v, sizeof(x->v)) == 0;
+}
+
+// An expression with nothing else set, so that any bits that it doesn't use
+// are zero, and don't spoil the comparison.
+static Expr BlankExpr(Expr::Op op) {
+    Expr e(0.0);
+    e.op = op;
+    e.a  = NULL;
+    return e;
+}
+
+Expr *Expr::Shared(const Expr &e) {
+    // Keep the table at most half full, so that the probes stay short.
+    if(SharedExprs.size() < 2 * SharedExprCount + 2) {
+        std::vector<Expr *> old;
+        std::swap(old, SharedExprs);
+        SharedExprs.assign(std::max((size_t)1024, 2 * old.size()), NULL);
+        size_t mask = SharedExprs.size() - 1;
+        for(Expr *o : old) {
+            if(!o) continue;
+            size_t h = HashExpr(o) & mask;
+            while(SharedExprs[h]) h = (h + 1) & mask;
+            SharedExprs[h] = o;
+        }
+    }
+
+    size_t mask = SharedExprs.size() - 1;
+    size_t h = HashExpr(&e) & mask;
+    while(SharedExprs[h]) {
+        if(SameExpr(SharedExprs[h], &e)) return SharedExprs[h];
+        h = (h + 1) & mask;
+    }
+
     Expr *r = AllocExpr();
-    r->op = Op::PARAM;
-    r->parh = p;
+    *r = e;
+    SharedExprs[h] = r;
+    SharedExprCount++;
     return r;
 }
 
+void Expr::FreeAllShared() {
+    SharedExprs.clear();
+    SharedExprCount = 0;
+}
+
+Expr *Expr::From(hParam p) {
+    Expr e = BlankExpr(Op::PARAM);
+    e.parh = p;
+    return Shared(e);
+}
+
 Expr *Expr::From(double v) {
     // Statically allocate common constants.
     // Note: this is only valid because AllocExpr() uses AllocTemporary(),
@@ -248,18 +322,62 @@ Expr *Expr::From(double v) {
         return &mhalf;
     }
 
-    Expr *r = AllocExpr();
-    r->op = Op::CONSTANT;
-    r->v = v;
-    return r;
+    Expr e = BlankExpr(Op::CONSTANT);
+    e.v = v;
+    return Shared(e);
+}
+
+bool Expr::IsConstant(double c) const {
+    return op == Op::CONSTANT && v == c;
 }
 
 Expr *Expr::AnyOp(Op newOp, Expr *b) {
-    Expr *r = AllocExpr();
-    r->op = newOp;
-    r->a = this;
-    r->b = b;
-    return r;
+    Expr e = BlankExpr(newOp);
+    e.a = this;
+    e.b = b;
+
+    // If the operands are all known, then we can evaluate immediately.
+    if(op == Op::CONSTANT && (!b || b->op == Op::CONSTANT)) {
+        return From(e.Eval());
+    }
+
+    // These are all exact, at least for the finite values that we're
+    // interested in.
+    switch(newOp) {
+        case Op::PLUS:
+            // x + 0 = 0 + x = x
+            if(b->IsConstant(0)) return this;
+            if(IsConstant(0)) return b;
+            break;
+
+        case Op::MINUS:
+            // x - 0 = x, 0 - x = -x, x - x = 0
+            if(b->IsConstant(0)) return this;
+            if(IsConstant(0)) return b->Negate();
+            if(this == b) return From(0.0);
+            break;
+
+        case Op::TIMES:
+            // x*1 = 1*x = x, x*0 = 0*x = 0
+            if(b->IsConstant(1)) return this;
+            if(IsConstant(1)) return b;
+            if(b->IsConstant(0) || IsConstant(0)) return From(0.0);
+            break;
+
+        case Op::DIV:
+            // x/1 = x
+            if(b->IsConstant(1)) return this;
+            break;
+
+        case Op::NEGATE:
+            // -(-x) = x
+            if(op == Op::NEGATE) return a;
+            break;
+
+        default:
+            break;
+    }
+    return Shared(e);
 }
 
 int Expr::Children() const {
@@ -357,49 +475,6 @@ double Expr::Eval() const {
     ssassert(false, "Unexpected operation");
 }
 
-Expr *Expr::PartialWrt(hParam p) const {
-    Expr *da, *db;
-
-    switch(op) {
-        case Op::PARAM_PTR: return From(p.v == parp->h.v ? 1 : 0);
-        case Op::PARAM:     return From(p.v == parh.v ? 1 : 0);
-
-        case Op::CONSTANT:  return From(0.0);
-        case Op::VARIABLE:  ssassert(false, "Not supported yet");
-
-        case Op::PLUS:      return (a->PartialWrt(p))->Plus(b->PartialWrt(p));
-        case Op::MINUS:     return (a->PartialWrt(p))->Minus(b->PartialWrt(p));
-
-        case Op::TIMES:
-            da = a->PartialWrt(p);
-            db = b->PartialWrt(p);
-            return (a->Times(db))->Plus(b->Times(da));
-
-        case Op::DIV:
-            da = a->PartialWrt(p);
-            db = b->PartialWrt(p);
-            return ((da->Times(b))->Minus(a->Times(db)))->Div(b->Square());
-
-        case Op::SQRT:
-            return (From(0.5)->Div(a->Sqrt()))->Times(a->PartialWrt(p));
-
-        case Op::SQUARE:
-            return (From(2.0)->Times(a))->Times(a->PartialWrt(p));
-
-        case Op::NEGATE:    return (a->PartialWrt(p))->Negate();
-        case Op::SIN:       return (a->Cos())->Times(a->PartialWrt(p));
-        case Op::COS:       return ((a->Sin())->Times(a->PartialWrt(p)))->Negate();
-
-        case Op::ASIN:
-            return (From(1)->Div((From(1)->Minus(a->Square()))->Sqrt()))
-                        ->Times(a->PartialWrt(p));
-        case Op::ACOS:
-            return (From(-1)->Div((From(1)->Minus(a->Square()))->Sqrt()))
-                        ->Times(a->PartialWrt(p));
-    }
-    ssassert(false, "Unexpected operation");
-}
-
 uint64_t Expr::ParamsUsed() const {
     uint64_t r = 0;
     if(op == Op::PARAM)     r |= ((uint64_t)1 << (parh.v % 61));
@@ -411,6 +486,15 @@ uint64_t Expr::ParamsUsed() const {
     return r;
 }
 
+void Expr::ParamsUsedList(std::vector<hParam> *list) const {
+    if(op == Op::PARAM)     list->push_back(parh);
+    if(op == Op::PARAM_PTR) list->push_back(parp->h);
+
+    int c = Children();
+    if(c >= 1)          a->ParamsUsedList(list);
+    if(c >= 2)          b->ParamsUsedList(list);
+}
+
 bool Expr::DependsOn(hParam p) const {
     if(op == Op::PARAM)     return (parh.v    == p.v);
     if(op == Op::PARAM_PTR) return (parp->h.v == p.v);
@@ -491,15 +575,42 @@ Expr *Expr::FoldConstants() {
     return n;
 }
 
-void Expr::Substitute(hParam oldh, hParam newh) {
+Expr *Expr::Substitute(hParam oldh, hParam newh) {
+    ssassert(op != Op::PARAM_PTR, "Expected an expression that refer to params via handles");
+
+    // Expressions are shared, so build a new one instead of changing this
+    // one; but only where something actually changed.
+    if(op == Op::PARAM) {
+        return (parh.v == oldh.v) ? From(newh) : this;
+    }
+    int c = Children();
+    if(c == 0) return this;
+
+    Expr *na = a->Substitute(oldh, newh);
+    Expr *nb = (c > 1) ? b->Substitute(oldh, newh) : NULL;
+    if(na == a && (c == 1 || nb == b)) return this;
+    return na->AnyOp(op, nb);
+}
+
+Expr *Expr::Substitute(const std::unordered_map<uint32_t, hParam> &subst,
+                       std::unordered_map<const Expr *, Expr *> *memo) {
     ssassert(op != Op::PARAM_PTR, "Expected an expression that refer to params via handles");
 
-    if(op == Op::PARAM && parh.v == oldh.v) {
-        parh = newh;
+    if(op == Op::PARAM) {
+        auto it = subst.find(parh.v);
+        return (it != subst.end()) ? From(it->second) : this;
     }
     int c = Children();
-    if(c >= 1) a->Substitute(oldh, newh);
-    if(c >= 2) b->Substitute(oldh, newh);
+    if(c == 0) return this;
+
+    auto it = memo->find(this);
+    if(it != memo->end()) return it->second;
+
+    Expr *na = a->Substitute(subst, memo);
+    Expr *nb = (c > 1) ? b->Substitute(subst, memo) : NULL;
+    Expr *r = (na == a && (c == 1 || nb == b)) ? this : na->AnyOp(op, nb);
+    (*memo)[this] = r;
+    return r;
 }
 
 //-----------------------------------------------------------------------------
@@ -541,6 +652,245 @@ hParam Expr::ReferencedParams(ParamList *pl) const {
 }
 
 
+//-----------------------------------------------------------------------------
+// Compile expressions to a flat list of instructions. Each distinct value
+// gets emitted only once, so any subexpressions that appear more than once
+// (and partial derivatives are full of them) are computed just once.
+//-----------------------------------------------------------------------------
+
+uint64_t ExprProgram::Hash(const Instruction &in) {
+    uint64_t h;
+    memcpy(&h, &in.v, sizeof(h));
+    h ^= ((uint64_t)in.op << 40) ^ ((uint64_t)(uint32_t)in.a << 20) ^ (uint32_t)in.b;
+    // Mix the bits well, since the low ones of a pointer are all zero.
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+bool ExprProgram::Equal(const Instruction &x, const Instruction &y) {
+    // Compare constants bit by bit, so that e.g. 0 and -0 stay distinct.
+    return x.op == y.op && x.a == y.a && x.b == y.b &&
+           memcmp(&x.v, &y.v, sizeof(x.v)) == 0;
+}
+
+static inline double EvalInstruction(const ExprProgram::Instruction &in,
+                                     const double *r) {
+    switch(in.op) {
+        case Expr::Op::PARAM_PTR:   return in.parp->val;
+        case Expr::Op::CONSTANT:    return in.v;
+
+        case Expr::Op::PLUS:        return r[in.a] + r[in.b];
+        case Expr::Op::MINUS:       return r[in.a] - r[in.b];
+        case Expr::Op::TIMES:       return r[in.a] * r[in.b];
+        case Expr::Op::DIV:         return r[in.a] / r[in.b];
+
+        case Expr::Op::NEGATE:      return -r[in.a];
+        case Expr::Op::SQRT:        return sqrt(r[in.a]);
+        case Expr::Op::SQUARE:      return r[in.a] * r[in.a];
+        case Expr::Op::SIN:         return sin(r[in.a]);
+        case Expr::Op::COS:         return cos(r[in.a]);
+        case Expr::Op::ACOS:        return acos(r[in.a]);
+        case Expr::Op::ASIN:        return asin(r[in.a]);
+
+        case Expr::Op::PARAM:
+        case Expr::Op::VARIABLE:
+            break;
+    }
+    ssassert(false, "Unexpected operation");
+}
+
+void ExprProgram::Clear() {
+    code.clear();
+    reg.clear();
+    adj.clear();
+    table.clear();
+    visited.clear();
+    visit = 0;
+}
+
+int ExprProgram::Emit(Instruction in) {
+    // Keep the table at most half full, so that the probes stay short.
+    if(table.size() < 2 * code.size() + 2) {
+        table.assign(std::max((size_t)64, 2 * table.size()), -1);
+        size_t mask = table.size() - 1;
+        for(int i = 0; i < Size(); i++) {
+            size_t h = Hash(code[i]) & mask;
+            while(table[h] >= 0) h = (h + 1) & mask;
+            table[h] = i;
+        }
+    }
+
+    size_t mask = table.size() - 1;
+    size_t h = Hash(in) & mask;
+    while(table[h] >= 0) {
+        if(Equal(code[table[h]], in)) return table[h];
+        h = (h + 1) & mask;
+    }
+
+    int r = Size();
+    table[h] = r;
+    code.push_back(in);
+    reg.push_back(in.op == Expr::Op::CONSTANT ? in.v : 0.0);
+    adj.push_back(0.0);
+    visited.push_back(0);
+    return r;
+}
+
+int ExprProgram::Add(const Expr *e) {
+    Instruction in = {};
+    in.op = e->op;
+    in.a  = -1;
+    in.b  = -1;
+    switch(e->op) {
+        case Expr::Op::PARAM:
+            in.op   = Expr::Op::PARAM_PTR;
+            in.parh = e->parh;
+            in.parp = SK.GetParam(e->parh);
+            return Emit(in);
+
+        case Expr::Op::PARAM_PTR:
+            in.parh = e->parp->h;
+            in.parp = e->parp;
+            return Emit(in);
+
+        case Expr::Op::CONSTANT:
+            in.v = e->v;
+            return Emit(in);
+
+        case Expr::Op::VARIABLE:
+            ssassert(false, "Not supported yet");
+
+        default:
+            break;
+    }
+
+    int c = e->Children();
+    in.a = Add(e->a);
+    if(c > 1) in.b = Add(e->b);
+    // Addition and multiplication are exactly commutative even in floating
+    // point, so put their operands in a consistent order, to share more.
+    if((in.op == Expr::Op::PLUS || in.op == Expr::Op::TIMES) && in.a > in.b) {
+        std::swap(in.a, in.b);
+    }
+
+    // If the operands are all known, then we can evaluate immediately.
+    if(code[in.a].op == Expr::Op::CONSTANT &&
+       (c == 1 || code[in.b].op == Expr::Op::CONSTANT))
+    {
+        Instruction k = {};
+        k.op = Expr::Op::CONSTANT;
+        k.a  = -1;
+        k.b  = -1;
+        k.v  = EvalInstruction(in, reg.data());
+        return Emit(k);
+    }
+    return Emit(in);
+}
+
+void ExprProgram::Eval() {
+    double *r = reg.data();
+    for(int i = 0; i < Size(); i++) {
+        r[i] = EvalInstruction(code[i], r);
+    }
+}
+
+void ExprProgram::ResolveParams(IdList<Param,hParam> *firstTry,
+                                IdList<Param,hParam> *thenTry) {
+    for(Instruction &in : code) {
+        if(in.op != Expr::Op::PARAM_PTR) continue;
+        Param *p = firstTry->FindByIdNoOops(in.parh);
+        if(!p) p = thenTry->FindById(in.parh);
+        in.parp = p;
+    }
+    // The table is by the old pointers, so it has to be built again before
+    // anything else gets added.
+    table.clear();
+}
+
+void ExprProgram::Dependencies(int r, std::vector<int> *deps) {
+    // The same subexpression may be used many times over, so mark what
+    // we've seen, to visit everything only once.
+    visit++;
+    size_t start = deps->size();
+    std::vector<int> stack = { r };
+    visited[r] = visit;
+    while(!stack.empty()) {
+        int i = stack.back();
+        stack.pop_back();
+        deps->push_back(i);
+
+        const Instruction &in = code[i];
+        for(int j : { in.a, in.b }) {
+            if(j < 0 || visited[j] == visit) continue;
+            visited[j] = visit;
+            stack.push_back(j);
+        }
+    }
+    std::sort(deps->begin() + start, deps->end());
+}
+
+void ExprProgram::Gradient(int r, const int *deps, int n) {
+    for(int k = 0; k < n; k++) {
+        adj[deps[k]] = 0.0;
+    }
+    adj[r] = 1.0;
+
+    // Every instruction comes after its operands, so going backwards we
+    // have the complete derivative with respect to each register by the
+    // time that we get to it, and can pass that on to its operands.
+    const double *v = reg.data();
+    double *d = adj.data();
+    for(int k = n - 1; k >= 0; k--) {
+        int i = deps[k];
+        const Instruction &in = code[i];
+        double g = d[i];
+        if(g == 0.0) continue;
+
+        switch(in.op) {
+            case Expr::Op::PARAM_PTR:
+            case Expr::Op::CONSTANT:
+                break;
+
+            case Expr::Op::PLUS:    d[in.a] += g; d[in.b] += g; break;
+            case Expr::Op::MINUS:   d[in.a] += g; d[in.b] -= g; break;
+            case Expr::Op::TIMES:
+                d[in.a] += g*v[in.b];
+                d[in.b] += g*v[in.a];
+                break;
+            case Expr::Op::DIV:
+                d[in.a] += g/v[in.b];
+                d[in.b] -= g*v[i]/v[in.b];
+                break;
+
+            case Expr::Op::NEGATE:  d[in.a] -= g; break;
+            case Expr::Op::SQRT:    d[in.a] += g*0.5/v[i]; break;
+            case Expr::Op::SQUARE:  d[in.a] += g*2.0*v[in.a]; break;
+            case Expr::Op::SIN:     d[in.a] += g*cos(v[in.a]); break;
+            case Expr::Op::COS:     d[in.a] -= g*sin(v[in.a]); break;
+            case Expr::Op::ASIN:
+                d[in.a] += g/sqrt(1 - v[in.a]*v[in.a]);
+                break;
+            case Expr::Op::ACOS:
+                d[in.a] -= g/sqrt(1 - v[in.a]*v[in.a]);
+                break;
+
+            case Expr::Op::PARAM:
+            case Expr::Op::VARIABLE:
+                ssassert(false, "Unexpected operation");
+        }
+    }
+}
+
+size_t ExprProgram::MemoryUsed() const {
+    return CapacityBytes(code) + CapacityBytes(reg) + CapacityBytes(adj) +
+           CapacityBytes(table) + CapacityBytes(visited);
+}
+
+
 //-----------------------------------------------------------------------------
 // Routines to pretty-print an expression. Mostly for debugging.
 //-----------------------------------------------------------------------------
@@ -54,6 +54,10 @@ public:
     static Expr *From(hParam p);
     static Expr *From(double v);
 
+    // Forget all the shared expressions of this thread; called when its
+    // temporary memory is freed, since that's where they live.
+    static void FreeAllShared();
+
     Expr *AnyOp(Op op, Expr *b);
     inline Expr *Plus (Expr *b_) { return AnyOp(Op::PLUS,  b_); }
     inline Expr *Minus(Expr *b_) { return AnyOp(Op::MINUS, b_); }
@@ -68,13 +72,19 @@ public:
     inline Expr *ASin  () { return AnyOp(Op::ASIN,   NULL); }
     inline Expr *ACos  () { return AnyOp(Op::ACOS,   NULL); }
 
-    Expr *PartialWrt(hParam p) const;
     double Eval() const;
     uint64_t ParamsUsed() const;
+    void ParamsUsedList(std::vector<hParam> *list) const;
     bool DependsOn(hParam p) const;
     static bool Tol(double a, double b);
     Expr *FoldConstants();
-    void Substitute(hParam oldh, hParam newh);
+    Expr *Substitute(hParam oldh, hParam newh);
+    // Substitute every param in subst at once. Each distinct subexpression
+    // is rewritten just once, with the results kept in memo, which can be
+    // shared between calls with the same subst.
+    Expr *Substitute(const std::unordered_map<uint32_t, hParam> &subst,
+                     std::unordered_map<const Expr *, Expr *> *memo);
+    bool IsConstant(double c) const;
 
     static const hParam NO_PARAMS, MULTIPLE_PARAMS;
     hParam ReferencedParams(ParamList *pl) const;
@@ -98,6 +108,71 @@ public:
 
     static Expr *Parse(const char *input, std::string *error);
     static Expr *From(const char *in, bool popUpError);
+
+private:
+    static Expr *Shared(const Expr &e);
+};
+
+// A list of expressions, compiled to a flat list of instructions that can be
+// evaluated much faster than walking the trees. Each instruction writes its
+// own register, and identical subexpressions (of the same or of different
+// expressions) are computed just once.
+class ExprProgram {
+public:
+    struct Instruction {
+        Expr::Op    op;
+        // The registers that hold the operands
+        int         a, b;
+        // For PARAM_PTR, the param that parp points to, so that it can be
+        // found again if the param table moves
+        hParam      parh;
+        union {
+            double  v;
+            Param  *parp;
+        };
+    };
+
+    // The result of code[i] goes in reg[i]; and the derivative of whatever
+    // Gradient() was last asked about, with respect to that, in adj[i].
+    std::vector<Instruction>    code;
+    std::vector<double>         reg;
+    std::vector<double>         adj;
+
+    void Clear();
+    // Add an expression, returning the register that will hold its value.
+    // Params referenced by handle are resolved to pointers now, so the
+    // param table mustn't move afterwards.
+    int Add(const Expr *e);
+    int Size() const { return (int)code.size(); }
+
+    void Eval();
+    // Find the params again by handle, first in firstTry and then thenTry,
+    // after the tables that they were in have been written again.
+    void ResolveParams(IdList<Param,hParam> *firstTry,
+                       IdList<Param,hParam> *thenTry);
+
+    // Append the registers that the value in register r depends on (itself
+    // included) to deps, in increasing order.
+    void Dependencies(int r, std::vector<int> *deps);
+    // Find the derivative of the value in register r with respect to each of
+    // the n registers in deps, which must be its dependencies as above, by
+    // reverse mode automatic differentiation; the registers must be up to
+    // date. The result is in adj, for those registers only.
+    void Gradient(int r, const int *deps, int n);
+
+    size_t MemoryUsed() const;
+
+private:
+    // An open-addressed hash table of the instructions emitted so far, by
+    // their index in code, or -1 where empty; its size is a power of two.
+    std::vector<int>            table;
+    // For Dependencies(), the last time that each register was visited.
+    std::vector<int>            visited;
+    int                         visit = 0;
+
+    static uint64_t Hash(const Instruction &in);
+    static bool Equal(const Instruction &x, const Instruction &y);
+    int Emit(Instruction in);
 };
 
 class ExprVector {
@@ -495,24 +495,24 @@ bool SolveSpaceUI::LoadFromFile(const Platform::Path &filename, bool canCancel)
             if(sv.g.type == Group::Type::LINKED)
                 sv.g.opA.v = 0;
 
-            SK.group.Add(&(sv.g));
+            SK.group.AddUnsorted(&(sv.g));
             sv.g = {};
             sv.g.scale = 1; // default is 1, not 0; so legacy files need this
         } else if(strcmp(line, "AddParam")==0) {
             // params are regenerated, but we want to preload the values
             // for initial guesses
-            SK.param.Add(&(sv.p));
+            SK.param.AddUnsorted(&(sv.p));
             sv.p = {};
         } else if(strcmp(line, "AddEntity")==0) {
             // entities are regenerated
         } else if(strcmp(line, "AddRequest")==0) {
-            SK.request.Add(&(sv.r));
+            SK.request.AddUnsorted(&(sv.r));
             sv.r = {};
         } else if(strcmp(line, "AddConstraint")==0) {
-            SK.constraint.Add(&(sv.c));
+            SK.constraint.AddUnsorted(&(sv.c));
             sv.c = {};
         } else if(strcmp(line, "AddStyle")==0) {
-            SK.style.Add(&(sv.s));
+            SK.style.AddUnsorted(&(sv.s));
             sv.s = {};
             Style::FillDefaultStyle(&sv.s);
         } else if(strcmp(line, VERSION_STRING)==0) {
@@ -535,6 +535,12 @@ bool SolveSpaceUI::LoadFromFile(const Platform::Path &filename, bool canCancel)
 
     fclose(fh);
 
+    SK.group.Sort();
+    SK.param.Sort();
+    SK.request.Sort();
+    SK.constraint.Sort();
+    SK.style.Sort();
+
     if(fileLoadError) {
         Error(_("Unrecognized data in file. This file may be corrupt, or "
                 "from a newer version of the program."));
@@ -563,6 +569,8 @@ void SolveSpaceUI::UpgradeLegacyData() {
                 IdList<Entity,hEntity> entity = {};
                 IdList<Param,hParam>   param = {};
                 r.Generate(&entity, &param);
+                entity.Sort();
+                param.Sort();
 
                 // If we didn't load all of the entities and params that this
                 // request would generate, then add them now, so that we can
@@ -725,7 +733,7 @@ bool SolveSpaceUI::LoadEntitiesFromFile(const Platform::Path &filename, EntityLi
         } else if(strcmp(line, "AddParam")==0) {
 
         } else if(strcmp(line, "AddEntity")==0) {
-            le->Add(&(sv.e));
+            le->AddUnsorted(&(sv.e));
             sv.e = {};
         } else if(strcmp(line, "AddRequest")==0) {
 
@@ -780,7 +788,7 @@ bool SolveSpaceUI::LoadEntitiesFromFile(const Platform::Path &filename, EntityLi
             stb.backwards = (backwards != 0);
             srf.trim.Add(&stb);
         } else if(strcmp(line, "AddSurface")==0) {
-            sh->surface.Add(&srf);
+            sh->surface.AddUnsorted(&srf);
             srf = {};
         } else if(StrStartsWith(line, "Curve ")) {
             int isExact;
@@ -816,12 +824,16 @@ bool SolveSpaceUI::LoadEntitiesFromFile(const Platform::Path &filename, EntityLi
             scpt.vertex = (vertex != 0);
             crv.pts.Add(&scpt);
         } else if(strcmp(line, "AddCurve")==0) {
-            sh->curve.Add(&crv);
+            sh->curve.AddUnsorted(&crv);
             crv = {};
         } else ssassert(false, "Unexpected operation");
     }
 
     fclose(fh);
+
+    le->Sort();
+    sh->surface.Sort();
+    sh->curve.Sort();
     return true;
 }
 
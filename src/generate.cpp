@@ -13,21 +13,69 @@ void SolveSpaceUI::MarkGroupDirtyByEntity(hEntity he) {
     MarkGroupDirty(e->group);
 }
 
+// The group that an entity belongs to, worked out from its handle, so that
+// it works even if the entity hasn't been generated yet; or no group, if
+// there's no such entity.
+static hGroup GroupOfEntity(hEntity he) {
+    if(he.v == Entity::NO_ENTITY.v) return {};
+    if(he.isFromRequest()) {
+        Request *r = SK.request.FindByIdNoOops(he.request());
+        return r ? r->group : hGroup {};
+    }
+    return he.group();
+}
+
 void SolveSpaceUI::MarkGroupDirty(hGroup hg, bool onlyThis) {
-    int i;
-    bool go = false;
-    for(i = 0; i < SK.groupOrder.n; i++) {
-        Group *g = SK.GetGroup(SK.groupOrder.elem[i]);
-        if(g->h.v == hg.v) {
-            go = true;
+    unsaved = true;
+    ScheduleGenerateAll();
+
+    Group *dg = SK.group.FindByIdNoOops(hg);
+    if(!dg) return;
+    dg->clean = false;
+    if(onlyThis) return;
+
+    // Any later group that uses an entity from a dirty group, for its
+    // operands, its workplane, or in its requests and constraints, must be
+    // solved again too; but the others keep their solution. A group can
+    // only depend on groups before it, so in order, one pass finds them all.
+    std::vector<Group *> later;
+    std::unordered_map<uint32_t, std::vector<hGroup>> dependsOn;
+    for(Group &g : SK.group) {
+        if(g.order <= dg->order) continue;
+        later.push_back(&g);
+        dependsOn[g.h.v] = {
+            g.opA, g.opB,
+            GroupOfEntity(g.predef.origin),
+            GroupOfEntity(g.predef.entityB),
+            GroupOfEntity(g.predef.entityC),
+        };
+    }
+    std::sort(later.begin(), later.end(), [](Group *a, Group *b) {
+        return a->order < b->order;
+    });
+    for(Request &r : SK.request) {
+        auto it = dependsOn.find(r.group.v);
+        if(it == dependsOn.end()) continue;
+        it->second.push_back(GroupOfEntity(r.workplane));
+    }
+    for(Constraint &c : SK.constraint) {
+        auto it = dependsOn.find(c.group.v);
+        if(it == dependsOn.end()) continue;
+        for(hEntity he : { c.workplane, c.ptA, c.ptB,
+                           c.entityA, c.entityB, c.entityC, c.entityD }) {
+            it->second.push_back(GroupOfEntity(he));
         }
-        if(go) {
+    }
+
+    std::unordered_set<uint32_t> dirty = { hg.v };
+    for(Group *g : later) {
+        for(hGroup d : dependsOn[g->h.v]) {
+            if(d.v == 0 || !dirty.count(d.v)) continue;
             g->clean = false;
-            if(onlyThis) break;
+            dirty.insert(g->h.v);
+            break;
         }
     }
-    unsaved = true;
-    ScheduleGenerateAll();
 }
 
 bool SolveSpaceUI::PruneOrphans() {
@@ -138,7 +186,7 @@ bool SolveSpaceUI::PruneConstraints(hGroup hg) {
     return false;
 }
 
-void SolveSpaceUI::GenerateAll(Generate type, bool andFindFree, bool genForBBox) {
+void SolveSpaceUI::GenerateAll(Generate type, bool andFindFree) {
     int first = 0, last = 0, i, j;
 
     uint64_t startMillis = GetMilliseconds(),
@@ -200,16 +248,6 @@ void SolveSpaceUI::GenerateAll(Generate type, bool andFindFree, bool genForBBox)
         }
     }
 
-    // If we're generating entities for display, first we need to find
-    // the bounding box to turn relative chord tolerance to absolute.
-    if(!SS.exportMode && !genForBBox) {
-        GenerateAll(type, andFindFree, /*genForBBox=*/true);
-        BBox box = SK.CalculateEntityBBox(/*includeInvisibles=*/true);
-        Vector size = box.maxp.Minus(box.minp);
-        double maxSize = std::max({ size.x, size.y, size.z });
-        chordTolCalculated = maxSize * chordTol / 100.0;
-    }
-
     // Remove any requests or constraints that refer to a nonexistent
     // group; can check those immediately, since we know what the list
     // of groups should be.
@@ -239,6 +277,8 @@ void SolveSpaceUI::GenerateAll(Generate type, bool andFindFree, bool genForBBox)
 
             r->Generate(&(SK.entity), &(SK.param));
         }
+        SK.entity.Sort();
+        SK.param.Sort();
         for(j = 0; j < SK.constraint.n; j++) {
             Constraint *c = &SK.constraint.elem[j];
             if(c->group.v != g->h.v) continue;
@@ -270,20 +310,20 @@ void SolveSpaceUI::GenerateAll(Generate type, bool andFindFree, bool genForBBox)
             g->solved.how = SolveResult::OKAY;
             g->clean = true;
         } else {
-            if(i >= first && i <= last) {
-                // The group falls inside the range, so really solve it,
-                // and then regenerate the mesh based on the solved stuff.
-                if(genForBBox) {
-                    SolveGroupAndReport(g->h, andFindFree);
-                    g->GenerateLoops();
-                } else {
-                    g->GenerateShellAndMesh();
-                    g->clean = true;
-                }
+            // Between the first dirty group and the active group, a clean
+            // group doesn't depend on any dirty one, so its solution is
+            // still good; but its mesh is built on the previous group's, so
+            // that must be regenerated anyway, below.
+            bool keepSolution = (type == Generate::DIRTY &&
+                                 g->clean && g->IsSolvedOkay());
+            if(i >= first && i <= last && !keepSolution) {
+                // The group falls inside the range, so really solve it.
+                SolveGroupAndReport(g->h, andFindFree);
+                g->GenerateLoops();
             } else {
-                // The group falls outside the range, so just assume that
-                // it's good wherever we left it. The mesh is unchanged,
-                // and the parameters must be marked as known.
+                // The group falls outside the range, or keeps its solution,
+                // so just assume that it's good wherever we left it. The
+                // parameters must be marked as known.
                 for(j = 0; j < SK.param.n; j++) {
                     Param *newp = &(SK.param.elem[j]);
 
@@ -294,6 +334,69 @@ void SolveSpaceUI::GenerateAll(Generate type, bool andFindFree, bool genForBBox)
         }
     }
 
+    // If we're generating entities for display, we need the bounding box
+    // of everything that was just solved to turn relative chord tolerance
+    // to absolute, before any of the meshes are generated with it.
+    if(!SS.exportMode) {
+        BBox box = SK.CalculateEntityBBox(/*includeInvisibles=*/true);
+        Vector size = box.maxp.Minus(box.minp);
+        double maxSize = std::max({ size.x, size.y, size.z });
+        double prevChordTol = chordTolCalculated;
+        chordTolCalculated = maxSize * chordTol / 100.0;
+        if(chordTolCalculated != prevChordTol) {
+            // The loops were assembled with the tolerance from before, or
+            // for a group that kept its solution, from whenever it was last
+            // solved; so assemble them again with the new one.
+            for(i = 0; i < SK.groupOrder.n; i++) {
+                Group *g = SK.GetGroup(SK.groupOrder.elem[i]);
+                if(g->h.v == Group::HGROUP_REFERENCES.v) continue;
+                if(i < first || i > last) continue;
+                g->GenerateLoops();
+            }
+        }
+    }
+
+    // Now regenerate the meshes in the range based on the solved stuff. The
+    // shell of each group alone doesn't depend on any other group's, except
+    // that a step and repeat copies that of the group it repeats; so those
+    // are generated in waves, with the groups of each wave in parallel.
+    // Meanwhile the sketch, and the loops and shells of earlier waves, are
+    // only read; each group writes only its own shell, mesh and remap; and
+    // what the Booleans underneath share (the cache of classifying BSPs) is
+    // locked, with the rest (temporary heap, surface guesses) per thread.
+    std::vector<Group *> meshGroups;
+    std::unordered_map<uint32_t, int> meshWave;
+    int waves = 0;
+    for(i = 0; i < SK.groupOrder.n; i++) {
+        Group *g = SK.GetGroup(SK.groupOrder.elem[i]);
+        if(g->h.v == Group::HGROUP_REFERENCES.v) continue;
+        if(i < first || i > last) continue;
+
+        int wave = 0;
+        if(g->type == Group::Type::TRANSLATE || g->type == Group::Type::ROTATE) {
+            auto it = meshWave.find(g->opA.v);
+            if(it != meshWave.end()) wave = it->second + 1;
+        }
+        meshWave[g->h.v] = wave;
+        waves = std::max(waves, wave + 1);
+        meshGroups.push_back(g);
+    }
+    for(int wave = 0; wave < waves; wave++) {
+        std::vector<Group *> inWave;
+        for(Group *g : meshGroups) {
+            if(meshWave[g->h.v] == wave) inWave.push_back(g);
+        }
+        ThreadPool::Get()->ParallelFor((int)inWave.size(), [&](int k) {
+            inWave[k]->GenerateThisShellAndMesh();
+        });
+    }
+    // And then combine each with the running shell of the groups before it,
+    // in order, since each one is built on the one before.
+    for(Group *g : meshGroups) {
+        g->GenerateShellAndMesh();
+        g->clean = true;
+    }
+
     // And update any reference dimensions with their new values
     for(i = 0; i < SK.constraint.n; i++) {
         Constraint *c = &(SK.constraint.elem[i]);
@@ -356,6 +459,8 @@ void SolveSpaceUI::GenerateAll(Generate type, bool andFindFree, bool genForBBox)
         deleted = {};
     }
 
+    SBspUv::ForgetUnused();
+    sys.ForgetDeletedGroups();
     FreeAllTemporary();
     allConsistent = true;
     SS.GW.persistentDirty = true;
@@ -372,9 +477,8 @@ void SolveSpaceUI::GenerateAll(Generate type, bool andFindFree, bool genForBBox)
             case Generate::UNTIL_ACTIVE:    typeStr = "UNTIL_ACTIVE"; break;
         }
         if(endMillis)
-        dbp("Generate::%s%s took %lld ms",
+        dbp("Generate::%s took %lld ms",
             typeStr,
-            (genForBBox ? " (for bounding box)" : ""),
             GetMilliseconds() - startMillis);
     }
 
@@ -385,7 +489,7 @@ pruned:
     SK.param.Clear();
     prev.MoveSelfInto(&(SK.param));
     // Try again
-    GenerateAll(type, andFindFree, genForBBox);
+    GenerateAll(type, andFindFree);
 }
 
 void SolveSpaceUI::ForceReferences() {
@@ -516,6 +620,8 @@ void SolveSpaceUI::WriteEqSystemForGroup(hGroup hg) {
 
         r->Generate(&(sys.entity), &(sys.param));
     }
+    sys.entity.Sort();
+    sys.param.Sort();
     for(i = 0; i < SK.constraint.n; i++) {
         Constraint *c = &SK.constraint.elem[i];
         if(c->group.v != hg.v) continue;
@@ -536,6 +642,7 @@ void SolveSpaceUI::WriteEqSystemForGroup(hGroup hg) {
 }
 
 void SolveSpaceUI::SolveGroup(hGroup hg, bool andFindFree) {
+    MemoryTagScope tag(MemoryTag::SOLVER);
     WriteEqSystemForGroup(hg);
     Group *g = SK.GetGroup(hg);
     g->solved.remove.Clear();
@@ -552,6 +659,7 @@ void SolveSpaceUI::SolveGroup(hGroup hg, bool andFindFree) {
 }
 
 SolveResult SolveSpaceUI::TestRankForGroup(hGroup hg) {
+    MemoryTagScope tag(MemoryTag::SOLVER);
     WriteEqSystemForGroup(hg);
     Group *g = SK.GetGroup(hg);
     SolveResult result = sys.SolveRank(g, NULL, NULL, false, false,
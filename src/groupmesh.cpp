@@ -102,17 +102,19 @@ void SMesh::RemapFaces(Group *g, int remap) {
     }
 }
 
+// The copies for a step and repeat are counted with whatever they copy.
+static MemoryTag MemoryTagFor(SShell *) { return MemoryTag::SHELL; }
+static MemoryTag MemoryTagFor(SMesh *)  { return MemoryTag::MESH; }
+
 template<class T>
 void Group::GenerateForStepAndRepeat(T *steps, T *outs, Group::CombineAs forWhat) {
-    T workA, workB;
-    workA = {};
-    workB = {};
-    T *soFar = &workA, *scratch = &workB;
-
     int n = (int)valA, a0 = 0;
     if(subtype == Subtype::ONE_SIDED && skipFirst) {
         a0++; n++;
     }
+
+    // First make all the transformed copies.
+    std::vector<T> copies;
     int a;
     for(a = a0; a < n; a++) {
         int ap = a*2 - (subtype == Subtype::ONE_SIDED ? 0 : (n-1));
@@ -137,23 +139,46 @@ void Group::GenerateForStepAndRepeat(T *steps, T *outs, Group::CombineAs forWhat
 
         // We need to rewrite any plane face entities to the transformed ones.
         transd.RemapFaces(this, remap);
+        copies.push_back(transd);
+    }
 
-        // And tack this transformed copy on to the return.
-        if(soFar->IsEmpty()) {
-            scratch->MakeFromCopyOf(&transd);
-        } else if (forWhat == CombineAs::ASSEMBLE) {
-            scratch->MakeFromAssemblyOf(soFar, &transd);
-        } else {
-            scratch->MakeFromUnionOf(soFar, &transd);
+    // Then combine them in pairs, and those pairs in pairs, and so on, so
+    // that each Boolean is between two pieces of about the same size, and
+    // not between each copy and everything so far. The pairs of each round
+    // are independent, so they're combined at once. Pieces whose bounding
+    // boxes are disjoint can't intersect, so those are just assembled.
+    while(copies.size() > 1) {
+        std::vector<T> combined(copies.size() / 2);
+        ThreadPool::Get()->ParallelFor((int)combined.size(), [&](int i) {
+            MemoryTagScope tag(MemoryTagFor(steps));
+            TempScope scope;
+
+            T *x = &copies[2*i], *y = &copies[2*i + 1];
+            Vector xmax, xmin, ymax, ymin;
+            x->GetBounding(&xmax, &xmin);
+            y->GetBounding(&ymax, &ymin);
+            if(forWhat == CombineAs::ASSEMBLE || x->IsEmpty() || y->IsEmpty() ||
+               Vector::BoundingBoxesDisjoint(xmax, xmin, ymax, ymin))
+            {
+                combined[i].MakeFromAssemblyOf(x, y);
+            } else {
+                combined[i].MakeFromUnionOf(x, y);
+            }
+            x->Clear();
+            y->Clear();
+        });
+        if(copies.size() % 2 != 0) {
+            combined.push_back(copies.back());
         }
-
-        swap(scratch, soFar);
-        scratch->Clear();
-        transd.Clear();
+        copies = std::move(combined);
     }
 
     outs->Clear();
-    *outs = *soFar;
+    if(!copies.empty()) {
+        *outs = copies[0];
+    } else {
+        *outs = {};
+    }
 }
 
 template<class T>
@@ -177,16 +202,15 @@ void Group::GenerateForBoolean(T *prevs, T *thiss, T *outs, Group::CombineAs how
     }
 }
 
-void Group::GenerateShellAndMesh() {
-    bool prevBooleanFailed = booleanFailed;
-    booleanFailed = false;
+void Group::GenerateThisShellAndMesh() {
+    // This may run on any thread, so tag it here and not in the caller.
+    MemoryTagScope tag(MemoryTag::SHELL);
+    TempScope scope;
 
     Group *srcg = this;
 
     thisShell.Clear();
     thisMesh.Clear();
-    runningShell.Clear();
-    runningMesh.Clear();
 
     // Don't attempt a lathe or extrusion unless the source section is good:
     // planar and not self-intersecting.
@@ -310,10 +334,24 @@ void Group::GenerateShellAndMesh() {
     if(srcg->meshCombine != CombineAs::ASSEMBLE) {
         thisShell.MergeCoincidentSurfaces();
     }
+}
+
+void Group::GenerateShellAndMesh() {
+    MemoryTagScope tag(MemoryTag::SHELL);
+    bool prevBooleanFailed = booleanFailed;
+    booleanFailed = false;
+
+    runningShell.Clear();
+    runningMesh.Clear();
 
     // So now we've got the mesh or shell for this group. Combine it with
     // the previous group's mesh or shell with the requested Boolean, and
-    // we're done.
+    // we're done. A step and repeat gets merged against the group's
+    // previous group, not our own previous group.
+    Group *srcg = this;
+    if(type == Type::TRANSLATE || type == Type::ROTATE) {
+        srcg = SK.GetGroup(opA);
+    }
 
     Group *prevg = srcg->RunningMeshGroup();
 
@@ -365,6 +403,7 @@ void Group::GenerateShellAndMesh() {
 }
 
 void Group::GenerateDisplayItems() {
+    MemoryTagScope tag(MemoryTag::MESH);
     // This is potentially slow (since we've got to triangulate a shell, or
     // to find the emphasized edges for a mesh), so we will run it only
     // if its inputs have changed.
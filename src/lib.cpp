@@ -85,6 +85,7 @@ void Slvs_Solve(Slvs_System *ssys, Slvs_hGroup shg)
         IsInit = 1;
     }
 
+    MemoryTagScope tag(MemoryTag::SOLVER);
     int i;
     for(i = 0; i < ssys->params; i++) {
         Slvs_Param *sp = &(ssys->param[i]);
@@ -92,11 +93,13 @@ void Slvs_Solve(Slvs_System *ssys, Slvs_hGroup shg)
 
         p.h.v = sp->h;
         p.val = sp->val;
-        SK.param.Add(&p);
+        SK.param.AddUnsorted(&p);
         if(sp->group == shg) {
-            SYS.param.Add(&p);
+            SYS.param.AddUnsorted(&p);
         }
     }
+    SK.param.Sort();
+    SYS.param.Sort();
 
     for(i = 0; i < ssys->entities; i++) {
         Slvs_Entity *se = &(ssys->entity[i]);
@@ -130,8 +133,9 @@ default: dbp("bad entity type %d", se->type); return;
         e.param[2].v    = se->param[2];
         e.param[3].v    = se->param[3];
 
-        SK.entity.Add(&e);
+        SK.entity.AddUnsorted(&e);
     }
+    SK.entity.Sort();
     IdList<Param, hParam> params = {};
     for(i = 0; i < ssys->constraints; i++) {
         Slvs_Constraint *sc = &(ssys->constraint[i]);
@@ -203,8 +207,9 @@ default: dbp("bad constraint type %d", sc->type); return;
             c.ModifyToSatisfy();
         }
 
-        SK.constraint.Add(&c);
+        SK.constraint.AddUnsorted(&c);
     }
+    SK.constraint.Sort();
 
     for(i = 0; i < (int)arraylen(ssys->dragged); i++) {
         if(ssys->dragged[i]) {
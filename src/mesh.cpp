@@ -110,6 +110,7 @@ void SMesh::Simplify(int start) {
 
     STriMeta meta = l.elem[start].meta;
 
+    TempScope scope;
     STriangle *tout = (STriangle *)AllocTemporary(maxTriangles*sizeof(*tout));
     int toutc = 0;
 
@@ -236,8 +237,6 @@ void SMesh::Simplify(int start) {
     for(i = 0; i < toutc; i++) {
         AddTriangle(&(tout[i]));
     }
-    FreeTemporary(tout);
-    FreeTemporary(conv);
 }
 
 void SMesh::AddAgainstBsp(SMesh *srcm, SBsp3 *bsp3) {
@@ -891,6 +891,8 @@ hRequest GraphicsWindow::AddRequest(Request::Type type, bool rememberForUndo) {
     // we mustn't try to solve until reasonable values have been supplied
     // for these new parameters, or else we'll get a numerical blowup.
     r.Generate(&SK.entity, &SK.param);
+    SK.entity.Sort();
+    SK.param.Sort();
     SS.MarkGroupDirty(r.group);
     return r.h;
 }
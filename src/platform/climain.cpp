@@ -30,6 +30,11 @@ Common options:
         piecewise linear, and exact surfaces into triangle meshes.
         For export commands, the unit is mm, and the default is 1.0 mm.
         For non-export commands, the unit is %%, and the default is 1.0 %%.
+    -m, --memory-usage
+        After each file, prints how much memory was used for it, by what it
+        was used for, both at the end and at most. The solver's memory is
+        counted by what its matrices have reserved; the BSPs are those kept
+        for the surfaces between Booleans, and the others are temporary.
 
 Commands:
     thumbnail --output <pattern> --size <size> --view <direction>
@@ -83,6 +88,18 @@ File formats:
     FormatListFromFileFilter(SurfaceFileFilter).c_str());
 }
 
+static void ShowMemoryUsage(const Platform::Path &inputFile) {
+    fprintf(stderr, "Memory used for '%s':\n", inputFile.raw.c_str());
+    fprintf(stderr, "    %-10s %12s %12s\n", "", "current", "peak");
+    for(int i = 0; i < MemoryUsage::TAGS; i++) {
+        MemoryTag tag = (MemoryTag)i;
+        fprintf(stderr, "    %-10s %12s %12s\n", MemoryUsage::TagName(tag),
+                MemoryUsage::FormatBytes(MemoryUsage::Current(tag)).c_str(),
+                MemoryUsage::FormatBytes(MemoryUsage::Peak(tag)).c_str());
+    }
+    MemoryUsage::ResetPeaks();
+}
+
 static bool RunCommand(const std::vector<std::string> args) {
     if(args.size() < 2) return false;
 
@@ -158,6 +175,14 @@ static bool RunCommand(const std::vector<std::string> args) {
         } else return false;
     };
 
+    bool memoryUsage = false;
+    auto ParseMemoryUsage = [&](size_t &argn) {
+        if(args[argn] == "--memory-usage" || args[argn] == "-m") {
+            memoryUsage = true;
+            return true;
+        } else return false;
+    };
+
     unsigned width = 0, height = 0;
     if(args[1] == "thumbnail") {
         auto ParseSize = [&](size_t &argn) {
@@ -174,7 +199,8 @@ static bool RunCommand(const std::vector<std::string> args) {
                  ParseOutputPattern(argn) ||
                  ParseViewDirection(argn) ||
                  ParseChordTolerance(argn) ||
-                 ParseSize(argn))) {
+                 ParseSize(argn) ||
+                 ParseMemoryUsage(argn))) {
                 fprintf(stderr, "Unrecognized option '%s'.\n", args[argn].c_str());
                 return false;
             }
@@ -207,7 +233,8 @@ static bool RunCommand(const std::vector<std::string> args) {
             if(!(ParseInputFile(argn) ||
                  ParseOutputPattern(argn) ||
                  ParseViewDirection(argn) ||
-                 ParseChordTolerance(argn))) {
+                 ParseChordTolerance(argn) ||
+                 ParseMemoryUsage(argn))) {
                 fprintf(stderr, "Unrecognized option '%s'.\n", args[argn].c_str());
                 return false;
             }
@@ -229,7 +256,8 @@ static bool RunCommand(const std::vector<std::string> args) {
         for(size_t argn = 2; argn < args.size(); argn++) {
             if(!(ParseInputFile(argn) ||
                  ParseOutputPattern(argn) ||
-                 ParseChordTolerance(argn))) {
+                 ParseChordTolerance(argn) ||
+                 ParseMemoryUsage(argn))) {
                 fprintf(stderr, "Unrecognized option '%s'.\n", args[argn].c_str());
                 return false;
             }
@@ -244,7 +272,8 @@ static bool RunCommand(const std::vector<std::string> args) {
         for(size_t argn = 2; argn < args.size(); argn++) {
             if(!(ParseInputFile(argn) ||
                  ParseOutputPattern(argn) ||
-                 ParseChordTolerance(argn))) {
+                 ParseChordTolerance(argn) ||
+                 ParseMemoryUsage(argn))) {
                 fprintf(stderr, "Unrecognized option '%s'.\n", args[argn].c_str());
                 return false;
             }
@@ -258,7 +287,8 @@ static bool RunCommand(const std::vector<std::string> args) {
     } else if(args[1] == "export-surfaces") {
         for(size_t argn = 2; argn < args.size(); argn++) {
             if(!(ParseInputFile(argn) ||
-                 ParseOutputPattern(argn))) {
+                 ParseOutputPattern(argn) ||
+                 ParseMemoryUsage(argn))) {
                 fprintf(stderr, "Unrecognized option '%s'.\n", args[argn].c_str());
                 return false;
             }
@@ -270,7 +300,8 @@ static bool RunCommand(const std::vector<std::string> args) {
         };
     } else if(args[1] == "regenerate") {
         for(size_t argn = 2; argn < args.size(); argn++) {
-            if(!(ParseInputFile(argn))) {
+            if(!(ParseInputFile(argn) ||
+                 ParseMemoryUsage(argn))) {
                 fprintf(stderr, "Unrecognized option '%s'.\n", args[argn].c_str());
                 return false;
             }
@@ -300,6 +331,7 @@ static bool RunCommand(const std::vector<std::string> args) {
         return false;
     }
 
+    MemoryUsage::Enable(memoryUsage);
     for(const Platform::Path &inputFile : inputFiles) {
         Platform::Path absInputFile = inputFile.Expand(/*fromCurrentDirectory=*/true);
 
@@ -319,6 +351,9 @@ static bool RunCommand(const std::vector<std::string> args) {
         }
         SS.AfterNewFile();
         runner(absOutputFile);
+        if(memoryUsage) {
+            ShowMemoryUsage(inputFile);
+        }
         SK.Clear();
         SS.Clear();
 
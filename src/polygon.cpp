@@ -481,21 +481,14 @@ int SKdNodeEdges::AnyEdgeCrossings(Vector a, Vector b, int cnt,
 // We have an edge list that contains only collinear edges, maybe with more
 // splits than necessary. Merge any collinear segments that join.
 //-----------------------------------------------------------------------------
-static Vector LineStart, LineDirection;
-static int ByTAlongLine(const void *av, const void *bv)
-{
-    SEdge *a = (SEdge *)av,
-          *b = (SEdge *)bv;
-
-    double ta = (a->a.Minus(LineStart)).DivPivoting(LineDirection),
-           tb = (b->a.Minus(LineStart)).DivPivoting(LineDirection);
-
-    return (ta > tb) ? 1 : -1;
-}
 void SEdgeList::MergeCollinearSegments(Vector a, Vector b) {
-    LineStart = a;
-    LineDirection = b.Minus(a);
-    qsort(l.elem, l.n, sizeof(l.elem[0]), ByTAlongLine);
+    // Sort them along the line; which is kept here, not in a static, since
+    // edge lists are worked on from many threads.
+    Vector lineDirection = b.Minus(a);
+    std::stable_sort(l.elem, l.elem + l.n, [&](const SEdge &ea, const SEdge &eb) {
+        return (ea.a.Minus(a)).DivPivoting(lineDirection) <
+               (eb.a.Minus(a)).DivPivoting(lineDirection);
+    });
 
     l.ClearTags();
     int i;
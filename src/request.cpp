@@ -163,7 +163,7 @@ void Request::Generate(IdList<Entity,hEntity> *entity,
             p.param[0] = AddParam(param, h.param(16 + 3*i + 0));
             p.param[1] = AddParam(param, h.param(16 + 3*i + 1));
         }
-        entity->Add(&p);
+        entity->AddUnsorted(&p);
         e.point[i] = p.h;
     }
     if(hasNormal) {
@@ -187,7 +187,7 @@ void Request::Generate(IdList<Entity,hEntity> *entity,
         // The point determines where the normal gets displayed on-screen;
         // it's entirely cosmetic.
         n.point[0] = e.point[0];
-        entity->Add(&n);
+        entity->AddUnsorted(&n);
         e.normal = n.h;
     }
     if(hasDistance) {
@@ -198,11 +198,11 @@ void Request::Generate(IdList<Entity,hEntity> *entity,
         d.style = style;
         d.type = Entity::Type::DISTANCE;
         d.param[0] = AddParam(param, h.param(64));
-        entity->Add(&d);
+        entity->AddUnsorted(&d);
         e.distance = d.h;
     }
 
-    if(et != (Entity::Type)0) entity->Add(&e);
+    if(et != (Entity::Type)0) entity->AddUnsorted(&e);
 }
 
 std::string Request::DescriptionString() const {
@@ -245,7 +245,7 @@ int Request::IndexOfPoint(hEntity he) const {
 hParam Request::AddParam(IdList<Param,hParam> *param, hParam hp) {
     Param pa = {};
     pa.h = hp;
-    param->Add(&pa);
+    param->AddUnsorted(&pa);
     return hp;
 }
 
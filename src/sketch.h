@@ -275,6 +275,12 @@ public:
     Group *RunningMeshGroup();
     bool IsMeshGroup();
 
+    // Generate the shell or mesh of this group alone. That only uses this
+    // group's entities and its operand's loops, or for a step and repeat,
+    // its operand's shell; so it can be done for many groups at once.
+    void GenerateThisShellAndMesh();
+    // Combine the shell or mesh of this group with the running one of the
+    // group before it; that must be done for the groups in order.
     void GenerateShellAndMesh();
     template<class T> void GenerateForStepAndRepeat(T *steps, T *outs, Group::CombineAs forWhat);
     template<class T> void GenerateForBoolean(T *a, T *b, T *o, Group::CombineAs how);
@@ -331,6 +337,8 @@ public:
     double      aspectRatio;
 
     static hParam AddParam(ParamList *param, hParam hp);
+    // The entities and params are added with AddUnsorted(), so that
+    // the requests of a whole group can be generated before sorting once.
     void Generate(EntityList *entity, ParamList *param);
 
     std::string DescriptionString() const;
@@ -30,6 +30,11 @@
 #include <set>
 #include <chrono>
 #include <sstream>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 // We declare these in advance instead of simply using FT_Library
 // (defined as typedef FT_LibraryRec_* FT_Library) because including
@@ -219,10 +224,84 @@ std::vector<std::string> InitPlatform(int argc, char **argv);
 void *AllocTemporary(size_t n);
 void FreeTemporary(void *p);
 void FreeAllTemporary();
+// A position in this thread's temporary heap; everything allocated after it
+// can be freed at once with FreeTemporaryTo().
+struct TempMark {
+    void   *chunk;
+    size_t  used;
+};
+TempMark MarkTemporary();
+void FreeTemporaryTo(TempMark mark);
+// Everything that this thread allocates on the temporary heap while one of
+// these is in scope is freed when it goes out of scope.
+class TempScope {
+public:
+    TempScope() : mark(MarkTemporary()) {}
+    ~TempScope() { FreeTemporaryTo(mark); }
+    TempScope(const TempScope &) = delete;
+    TempScope &operator=(const TempScope &) = delete;
+
+private:
+    TempMark mark;
+};
 void *MemAlloc(size_t n);
 void MemFree(void *p);
 void vl(); // debug function to validate heaps
 
+// What memory is used for, when counting it.
+enum class MemoryTag : uint32_t {
+    OTHER     = 0,
+    SOLVER    = 1,
+    SHELL     = 2,
+    MESH      = 3,
+    RENDER    = 4,
+    UNDO      = 5,
+    // The classifying BSPs of surfaces, that are kept between Booleans.
+    BSP       = 6,
+    // The temporary heap, with the expressions, the other BSPs and so on;
+    // it's counted as a whole, whatever the tag that it was allocated under.
+    TEMPORARY = 7,
+};
+
+// The memory in use, by tag, both now and at most since the peaks were
+// reset. It's only counted while enabled, since that takes a little time;
+// memory allocated before then isn't counted, even once it's freed.
+class MemoryUsage {
+public:
+    static const int TAGS = 8;
+    // Room before each block from MemAlloc(), to note how it was counted.
+    static const size_t HEADER = 16;
+
+    static void Enable(bool enable);
+    static bool IsEnabled();
+    static size_t Current(MemoryTag tag);
+    static size_t Peak(MemoryTag tag);
+    static void ResetPeaks();
+
+    static const char *TagName(MemoryTag tag);
+    static std::string FormatBytes(size_t bytes);
+
+    // For MemAlloc() and MemFree(): block has n bytes plus HEADER, and the
+    // returned pointer is what the caller gets, or the block to free.
+    static void *Allocated(void *block, size_t n);
+    static void *Freed(void *p);
+    // For anything that keeps track of its own memory.
+    static void Count(MemoryTag tag, size_t bytes, bool allocated);
+};
+
+// While one of these is in scope, the memory that this thread allocates is
+// counted under its tag.
+class MemoryTagScope {
+public:
+    MemoryTagScope(MemoryTag tag);
+    ~MemoryTagScope();
+    MemoryTagScope(const MemoryTagScope &) = delete;
+    MemoryTagScope &operator=(const MemoryTagScope &) = delete;
+
+private:
+    MemoryTag prev;
+};
+
 #include "resource.h"
 
 // End of platform-specific functions
@@ -239,6 +318,7 @@ using handle_map = std::map<Key, T, CompareHandle<Key>>;
 class Group;
 class SSurface;
 #include "dsc.h"
+#include "threadpool.h"
 #include "polygon.h"
 #include "srf/surface.h"
 #include "render/render.h"
@@ -303,8 +383,6 @@ RgbaColor CnfThawColor(RgbaColor v, const std::string &name);
 
 class System {
 public:
-    enum { MAX_UNKNOWNS = 1024 };
-
     EntityList                      entity;
     ParamList                       param;
     IdList<Equation,hEquation>      eq;
@@ -315,63 +393,141 @@ public:
 
     enum {
         // In general, the tag indicates the subsys that a variable/equation
-        // has been assigned to; these are exceptions for variables:
-        VAR_SUBSTITUTED      = 10000,
-        VAR_DOF_TEST         = 10001,
+        // has been assigned to; these are exceptions for variables (negative,
+        // since there's no limit on the number of subsystems):
+        VAR_SUBSTITUTED      = -1,
         // and for equations:
-        EQ_SUBSTITUTED       = 20000
+        EQ_SUBSTITUTED       = -2
     };
 
-    // The system Jacobian matrix
-    struct {
+    // A Jacobian matrix, of the whole system or of some part of it
+    struct Matrix {
         // The corresponding equation for each row
-        hEquation   eq[MAX_UNKNOWNS];
+        std::vector<hEquation>  eq;
 
         // The corresponding parameter for each column
-        hParam      param[MAX_UNKNOWNS];
+        std::vector<hParam>     param;
 
         // We're solving AX = B
         int m, n;
         struct {
-            Expr        *sym[MAX_UNKNOWNS][MAX_UNKNOWNS];
-            double       num[MAX_UNKNOWNS][MAX_UNKNOWNS];
+            // Only the nonzero entries are stored, by row; the entries of
+            // row i are at rowStart[i] to rowStart[i+1]-1, sorted by column.
+            std::vector<int>     rowStart;
+            std::vector<int>     col;
+            // The register of prog that holds the unknown for each one
+            std::vector<int>     reg;
+            std::vector<double>  num;
         }           A;
 
-        double      scale[MAX_UNKNOWNS];
+        std::vector<double> scale;
 
         // Some helpers for the least squares solve
-        double AAt[MAX_UNKNOWNS][MAX_UNKNOWNS];
-        double Z[MAX_UNKNOWNS];
+        SparseSymmetricMatrix AAt;
+        std::vector<double> Z;
 
-        double      X[MAX_UNKNOWNS];
+        std::vector<double> X;
 
         struct {
-            Expr        *sym[MAX_UNKNOWNS];
-            double       num[MAX_UNKNOWNS];
+            std::vector<int>    reg;
+            std::vector<double> num;
         }           B;
-    } mat;
 
-    static const double RANK_MAG_TOLERANCE, CONVERGE_TOLERANCE;
-    int CalculateRank();
-    bool TestRank();
-    static bool SolveLinearSystem(double X[], double A[][MAX_UNKNOWNS],
-                                  double B[], int N);
-    bool SolveLeastSquares();
+        // The equations, compiled; and for each one, the registers that it
+        // depends on, at dep[depStart[i]] to dep[depStart[i+1]-1], which is
+        // all that we need to look at to find its partials.
+        ExprProgram         prog;
+        std::vector<int>    depStart;
+        std::vector<int>    dep;
+
+        // Whether the last solve had to fall back to DampedSolve(); only
+        // for the tests, which check that it's reached.
+        bool                damped = false;
+    };
 
-    bool WriteJacobian(int tag);
-    void EvalJacobian();
+    // The independent subsystems that are left after substitution and any
+    // single-equation solves; each one has its own tag, and refers to its
+    // equations and unknowns by index in eq and param. Each one also has its
+    // own Jacobian, so that they can be solved concurrently.
+    struct Subsystem {
+        int                 tag;
+        std::vector<int>    eq;
+        std::vector<int>    param;
+        Matrix              mat;
+        // Whether this converged the last time that it was solved, and if
+        // so, whether it was full rank.
+        bool                solved = false;
+        bool                rankOk = false;
+    };
+    std::vector<Subsystem>  subsys;
+    // The equations that are soluble alone, each with the one unknown that
+    // it determines, solved before the subsystems.
+    std::vector<Subsystem>  alone;
+
+    // The substitutions, and the subsystems above, depend only on the
+    // equations, so they're kept for each group, and reused when its
+    // equations are written again exactly as before (e.g. when dragging).
+    // The key is a hash of the equations, or zero if there's nothing kept;
+    // but a structure is only reused if all of its inputs are the same.
+    struct Structure {
+        uint64_t                key = 0;
+        std::vector<uint64_t>   inputs;
+        std::vector<int>        paramTag;
+        std::vector<hParam>     paramSubstd;
+        std::vector<int>        eqTag;
+        // Only while this isn't the current structure; the current one's
+        // are the ones above.
+        std::vector<Subsystem>  alone;
+        std::vector<Subsystem>  subsys;
+    };
+    Structure                                   structure;
+    hGroup                                      structureGroup = {};
+    std::unordered_map<uint32_t, Structure>     savedStructure;
+    // The inputs of the system being solved, written by StructureKey().
+    std::vector<uint64_t>                       structureInputs;
+
+    static const double RANK_MAG_TOLERANCE, CONVERGE_TOLERANCE;
+    int CalculateRank(Matrix *mat);
+    bool TestRank(Matrix *mat);
+    void WriteNormalMatrix(Matrix *mat);
+    bool SolveLeastSquares(Matrix *mat, double lambda = 0);
+
+    void WriteJacobian(int tag, Matrix *mat);
+    void WriteJacobian(const std::vector<int> &eqs, const std::vector<int> &params,
+                       Matrix *mat);
+    void EvalJacobian(Matrix *mat);
+    void EvalResiduals(Matrix *mat);
+    void EvalPartials(Matrix *mat);
 
     void WriteEquationsExceptFor(hConstraint hc, Group *g);
-    void FindWhichToRemoveToFixJacobian(Group *g, List<hConstraint> *bad, bool forceDofCheck);
+    void FindWhichToRemoveToFixJacobian(Group *g, List<hConstraint> *bad,
+                                        bool forceDofCheck);
     void SolveBySubstitution();
+    void FindSubsystems(int firstTag);
+    void ReportUnsatisfied(Matrix *mat, List<hConstraint> *bad);
+
+    void WriteStructureInputs(const Expr *e);
+    uint64_t StructureKey(bool forceDofCheck);
+    bool FindStructure(hGroup hg, uint64_t key);
+    void WriteStructure(uint64_t key, bool forceDofCheck);
 
     bool IsDragged(hParam p);
+    bool IsAnyDragged(Subsystem *ss);
+    bool IsSatisfied(Matrix *mat);
 
-    bool NewtonSolve(int tag);
+    bool NewtonSolve(Matrix *mat);
+    bool DampedSolve(Matrix *mat);
+    double ResidualNorm(Matrix *mat);
 
     void MarkParamsFree(bool findFree);
     int CalculateDof();
 
+    // The matrices and structures above keep their memory in vectors, not
+    // from MemAlloc(), so it's counted separately, by their capacity.
+    size_t memoryCounted = 0;
+    size_t MemoryUsed() const;
+    void CountMemory();
+
     SolveResult Solve(Group *g, int *dof, List<hConstraint> *bad,
                       bool andFindBad, bool andFindFree, bool forceDofCheck = false);
 
@@ -379,6 +535,7 @@ public:
                           bool andFindBad, bool andFindFree, bool forceDofCheck = false);
 
     void Clear();
+    void ForgetDeletedGroups();
 };
 
 #include "ttf.h"
@@ -774,6 +931,9 @@ public:
         hEntity     point;
     } traced;
     SEdgeList nakedEdges;
+    // Shells can be generated on many threads at once, and any of them may
+    // add to the naked edges, to show where something went wrong.
+    std::mutex nakedEdgesMutex;
     struct {
         bool        draw;
         Vector      ptA;
@@ -827,8 +987,7 @@ public:
         UNTIL_ACTIVE,
     };
 
-    void GenerateAll(Generate type = Generate::DIRTY, bool andFindFree = false,
-                     bool genForBBox = false);
+    void GenerateAll(Generate type = Generate::DIRTY, bool andFindFree = false);
     void SolveGroup(hGroup hg, bool andFindFree);
     void SolveGroupAndReport(hGroup hg, bool andFindFree);
     SolveResult TestRankForGroup(hGroup hg);
@@ -6,7 +6,7 @@
 //-----------------------------------------------------------------------------
 #include "solvespace.h"
 
-static int I;
+static thread_local int I;
 
 void SShell::MakeFromUnionOf(SShell *a, SShell *b) {
     MakeFromBoolean(a, b, SSurface::CombineAs::UNION);
@@ -24,17 +24,6 @@ void SShell::MakeFromDifferenceOf(SShell *a, SShell *b) {
 // the intersection of srfA and srfB.) Return a new pwl curve with everything
 // split.
 //-----------------------------------------------------------------------------
-static Vector LineStart, LineDirection;
-static int ByTAlongLine(const void *av, const void *bv)
-{
-    SInter *a = (SInter *)av,
-           *b = (SInter *)bv;
-
-    double ta = (a->p.Minus(LineStart)).DivPivoting(LineDirection),
-           tb = (b->p.Minus(LineStart)).DivPivoting(LineDirection);
-
-    return (ta > tb) ? 1 : -1;
-}
 SCurve SCurve::MakeCopySplitAgainst(SShell *agnstA, SShell *agnstB,
                                     SSurface *srfA, SSurface *srfB) const
 {
@@ -104,9 +93,15 @@ SCurve SCurve::MakeCopySplitAgainst(SShell *agnstA, SShell *agnstB,
             // And now sort them in order along the line. Note that we must
             // do that after refining, in case the refining would make two
             // points switch places.
-            LineStart = prev.p;
-            LineDirection = (p->p).Minus(prev.p);
-            qsort(il.elem, il.n, sizeof(il.elem[0]), ByTAlongLine);
+            // This runs on many threads at once, so the line is kept here
+            // for the comparison, and not in a static.
+            Vector lineStart = prev.p,
+                   lineDirection = (p->p).Minus(prev.p);
+            std::stable_sort(il.elem, il.elem + il.n,
+                [&](const SInter &a, const SInter &b) {
+                    return (a.p.Minus(lineStart)).DivPivoting(lineDirection) <
+                           (b.p.Minus(lineStart)).DivPivoting(lineDirection);
+                });
 
             // And now uses the intersections to generate our split pwl edge(s)
             Vector prev = Vector::From(VERY_POSITIVE, 0, 0);
@@ -272,6 +267,7 @@ static void TagByClassifiedEdge(SBspUv::Class bspclass, SShell::Class *indir, SS
 
 static void DEBUGEDGELIST(SEdgeList *sel, SSurface *surf) {
     dbp("print %d edges", sel->l.n);
+    std::lock_guard<std::mutex> lock(SS.nakedEdgesMutex);
     SEdge *se;
     for(se = sel->l.First(); se; se = sel->l.NextAfter(se)) {
         Vector mid = (se->a).Plus(se->b).ScaledBy(0.5);
@@ -402,7 +398,8 @@ void SSurface::EdgeNormalsWithinSurface(Point2d auv, Point2d buv,
 SSurface SSurface::MakeCopyTrimAgainst(SShell *parent,
                                        SShell *sha, SShell *shb,
                                        SShell *into,
-                                       SSurface::CombineAs type)
+                                       SSurface::CombineAs type,
+                                       int index, bool *failed)
 {
     bool opA = (parent == sha);
     SShell *agnst = opA ? shb : sha;
@@ -591,8 +588,8 @@ SSurface SSurface::MakeCopyTrimAgainst(SShell *parent,
     SPolygon poly = {};
     final.l.ClearTags();
     if(!final.AssemblePolygon(&poly, NULL, /*keepDir=*/true)) {
-        into->booleanFailed = true;
-        dbp("failed: I=%d, avoid=%d", I, choosing.l.n);
+        *failed = true;
+        dbp("failed: I=%d, avoid=%d", index, choosing.l.n);
         DEBUGEDGELIST(&final, &ret);
     }
     poly.Clear();
@@ -605,26 +602,197 @@ SSurface SSurface::MakeCopyTrimAgainst(SShell *parent,
 }
 
 void SShell::CopySurfacesTrimAgainst(SShell *sha, SShell *shb, SShell *into, SSurface::CombineAs type) {
-    SSurface *ss;
-    for(ss = surface.First(); ss; ss = surface.NextAfter(ss)) {
-        SSurface ssn;
-        ssn = ss->MakeCopyTrimAgainst(this, sha, shb, into, type);
-        ss->newH = into->surface.AddAndAssignId(&ssn);
-        I++;
+    // Each surface is trimmed without changing anything shared, so they're
+    // all done at once; but then added in order, so that they get the same
+    // handles as if they'd been done one at a time.
+    std::vector<SSurface> trimmed(surface.n);
+    std::vector<char> failed(surface.n, false);
+    int first = I;
+    ThreadPool::Get()->ParallelFor(surface.n, [&](int i) {
+        MemoryTagScope tag(MemoryTag::SHELL);
+        TempScope scope;
+        SSurfaceGuesses guesses;
+
+        bool f = false;
+        trimmed[i] = surface.elem[i].MakeCopyTrimAgainst(this, sha, shb, into,
+                                                         type, first + i, &f);
+        failed[i] = f;
+    });
+
+    for(int i = 0; i < surface.n; i++) {
+        surface.elem[i].newH = into->surface.AddAndAssignId(&trimmed[i]);
+        if(failed[i]) into->booleanFailed = true;
     }
+    I += surface.n;
+}
+
+//-----------------------------------------------------------------------------
+// Are these two exact curves identical, in either direction?
+//-----------------------------------------------------------------------------
+static bool SameExactCurve(SCurve *sc, SCurve *se, bool *backwards) {
+    if(!sc->isExact || !se->isExact) return false;
+
+    if(sc->exact.Equals(&(se->exact))) {
+        if(backwards) *backwards = false;
+        return true;
+    }
+    SBezier sbrev = sc->exact;
+    sbrev.Reverse();
+    if(sbrev.Equals(&(se->exact))) {
+        if(backwards) *backwards = true;
+        return true;
+    }
+    return false;
 }
 
 void SShell::MakeIntersectionCurvesAgainst(SShell *agnst, SShell *into) {
-    SSurface *sa;
-    for(sa = surface.First(); sa; sa = surface.NextAfter(sa)) {
-        SSurface *sb;
-        for(sb = agnst->surface.First(); sb; sb = agnst->surface.NextAfter(sb)){
-            // Intersect every surface from our shell against every surface
-            // from agnst; this will add zero or more curves to the curve
-            // list for into.
-            sa->IntersectAgainst(sb, this, agnst, into);
+    // Surfaces whose bounding boxes are disjoint can't intersect, so only
+    // look at the ones of agnst that the hierarchy says might.
+    SSurfaceBvh bvh;
+    bvh.Build(agnst);
+
+    // Intersect every surface from our shell against every nearby surface
+    // from agnst; this will add zero or more curves to the curve list for
+    // each of our surfaces. Those don't depend on each other, so they're
+    // all found at once.
+    std::vector<SShell> found(surface.n);
+    ThreadPool::Get()->ParallelFor(surface.n, [&](int i) {
+        MemoryTagScope tag(MemoryTag::SHELL);
+        TempScope scope;
+        SSurfaceGuesses guesses;
+
+        SSurface *sa = &surface.elem[i];
+        Vector amax, amin;
+        sa->GetAxisAlignedBounding(&amax, &amin);
+        std::vector<int> near;
+        bvh.FindOverlapping(amax, amin, &near);
+
+        for(int j : near) {
+            sa->IntersectAgainst(&agnst->surface.elem[j], this, agnst, &found[i]);
+        }
+    });
+
+    // An exact curve that's identical to one before it will follow that
+    // one's pwl, so only the first of each must be split where it intersects
+    // the surfaces of the shells; the curves before it are the ones already
+    // in the shell, and then the ones found in order. The numerical curves
+    // were split as they were found.
+    std::vector<SCurve *> all;
+    for(SShell &f : found) {
+        SCurve *sc;
+        for(sc = f.curve.First(); sc; sc = f.curve.NextAfter(sc)) {
+            all.push_back(sc);
+        }
+    }
+    std::vector<char> isSplit(all.size(), true);
+    std::vector<int> toSplit;
+    for(size_t k = 0; k < all.size(); k++) {
+        if(!all[k]->isExact) continue;
+        SCurve *se;
+        bool follows = false;
+        for(se = into->curve.First(); se && !follows; se = into->curve.NextAfter(se)) {
+            follows = SameExactCurve(all[k], se, NULL);
+        }
+        for(size_t l = 0; l < k && !follows; l++) {
+            follows = SameExactCurve(all[k], all[l], NULL);
+        }
+        if(!follows) toSplit.push_back((int)k);
+        isSplit[k] = !follows;
+    }
+    ThreadPool::Get()->ParallelFor((int)toSplit.size(), [&](int t) {
+        MemoryTagScope tag(MemoryTag::SHELL);
+        TempScope scope;
+        SSurfaceGuesses guesses;
+
+        SCurve *sc = all[toSplit[t]];
+        SCurve split = sc->MakeCopySplitAgainst(this, agnst,
+                                                surface.FindById(sc->surfA),
+                                                agnst->surface.FindById(sc->surfB));
+        sc->Clear();
+        *sc = split;
+    });
+
+    // Then add them in order, so that the curves come out the same as if
+    // we'd found them one at a time.
+    for(size_t k = 0; k < all.size(); k++) {
+        into->AddIntersectionCurve(all[k], isSplit[k] != 0, this, agnst);
+    }
+    for(SShell &f : found) {
+        f.curve.Clear();
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Add an intersection curve to the shell, taking ownership of its points.
+// If an exact curve is identical to one that's already there, then follow
+// that one's pwl exactly instead, and otherwise split it if that's not been
+// done yet; and drop it if it lies entirely outside one of its surfaces,
+// since it's then fake.
+//-----------------------------------------------------------------------------
+void SShell::AddIntersectionCurve(SCurve *sc, bool isSplit,
+                                  SShell *agnstA, SShell *agnstB) {
+    if(!sc->isExact) {
+        curve.AddAndAssignId(sc);
+        sc->pts = {};
+        return;
+    }
+
+    SCurve *existing = NULL, *se;
+    bool backwards = false;
+    for(se = curve.First(); se; se = curve.NextAfter(se)) {
+        if(SameExactCurve(sc, se, &backwards)) {
+            existing = se;
+            break;
+        }
+    }
+    if(existing) {
+        sc->pts.Clear();
+        SCurvePt *v;
+        for(v = existing->pts.First(); v; v = existing->pts.NextAfter(v)) {
+            sc->pts.Add(v);
+        }
+        if(backwards) sc->pts.Reverse();
+    } else if(!isSplit) {
+        // The identical curves before it were all fake, so it's on its own.
+        SCurve split = sc->MakeCopySplitAgainst(agnstA, agnstB,
+                                                agnstA->surface.FindById(sc->surfA),
+                                                agnstB->surface.FindById(sc->surfB));
+        sc->Clear();
+        *sc = split;
+    }
+
+    // Test if the curve lies entirely outside one of the surfaces.
+    SSurface *srfA = agnstA->surface.FindById(sc->surfA),
+             *srfB = agnstB->surface.FindById(sc->surfB);
+    SCurvePt *scpt;
+    bool withinA = false, withinB = false;
+    for(scpt = sc->pts.First(); scpt; scpt = sc->pts.NextAfter(scpt)) {
+        double tol = 0.01;
+        Point2d puv;
+        srfA->ClosestPointTo(scpt->p, &puv);
+        if(puv.x > -tol && puv.x < 1 + tol &&
+           puv.y > -tol && puv.y < 1 + tol)
+        {
+            withinA = true;
+        }
+        srfB->ClosestPointTo(scpt->p, &puv);
+        if(puv.x > -tol && puv.x < 1 + tol &&
+           puv.y > -tol && puv.y < 1 + tol)
+        {
+            withinB = true;
         }
+        // Break out early, no sense wasting time if we already have the answer.
+        if(withinA && withinB) break;
     }
+    if(!(withinA && withinB)) {
+        // Intersection curve lies entirely outside one of the surfaces, so
+        // it's fake.
+        sc->Clear();
+        return;
+    }
+
+    curve.AddAndAssignId(sc);
+    sc->pts = {};
 }
 
 void SShell::CleanupAfterBoolean() {
@@ -760,12 +928,167 @@ void SShell::MakeClassifyingBsps(SShell *useCurvesFrom) {
     }
 }
 
+//-----------------------------------------------------------------------------
+// Most of the surfaces in a Boolean are the same as in the last one, or the
+// last regeneration, just copied into a new shell; so their classifying BSPs
+// are kept, in their own memory, and found again by everything that they're
+// built from. That's the surface itself, and the points of the curves that
+// trim it, written out as the bits of each number in turn. They're looked up
+// by a hash of those, but a BSP is only used if they're all the same.
+//-----------------------------------------------------------------------------
+struct CachedBsp {
+    std::vector<uint64_t>   inputs;
+    size_t                  counted;
+    SBspUv                 *nodes;
+    bool                    used;
+};
+static std::mutex                                   BspCacheMutex;
+static std::unordered_multimap<uint64_t, CachedBsp> BspCache;
+
+static void AddBspInput(std::vector<uint64_t> *inputs, double d) {
+    uint64_t x;
+    memcpy(&x, &d, sizeof(x));
+    inputs->push_back(x);
+}
+
+static void AddBspInput(std::vector<uint64_t> *inputs, Vector v) {
+    AddBspInput(inputs, v.x);
+    AddBspInput(inputs, v.y);
+    AddBspInput(inputs, v.z);
+}
+
+static void GetBspInputs(SSurface *srf, SShell *shell, SShell *useCurvesFrom,
+                         std::vector<uint64_t> *inputs) {
+    inputs->clear();
+    inputs->push_back((uint64_t)srf->degm);
+    inputs->push_back((uint64_t)srf->degn);
+    for(int i = 0; i <= srf->degm; i++) {
+        for(int j = 0; j <= srf->degn; j++) {
+            AddBspInput(inputs, srf->ctrl[i][j]);
+            AddBspInput(inputs, srf->weight[i][j]);
+        }
+    }
+    STrimBy *stb;
+    for(stb = srf->trim.First(); stb; stb = srf->trim.NextAfter(stb)) {
+        SCurve *sc = shell->curve.FindById(stb->curve);
+        if(useCurvesFrom) {
+            sc = useCurvesFrom->curve.FindById(sc->newH);
+        }
+        inputs->push_back((uint64_t)stb->backwards);
+        AddBspInput(inputs, stb->start);
+        AddBspInput(inputs, stb->finish);
+        inputs->push_back((uint64_t)sc->pts.n);
+        SCurvePt *pt;
+        for(pt = sc->pts.First(); pt; pt = sc->pts.NextAfter(pt)) {
+            AddBspInput(inputs, pt->p);
+        }
+    }
+}
+
+static uint64_t HashBspInputs(const std::vector<uint64_t> &inputs) {
+    // Mix each word before it's combined, so that a change in any of its
+    // bits (like the sign) changes all the bits of the hash; otherwise two
+    // changes to the same bit, as when a face is turned around, cancel out.
+    uint64_t h = 0;
+    for(uint64_t x : inputs) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        h = (h ^ x) * 0x9e3779b97f4a7c15ULL;
+    }
+    return h;
+}
+
+// Find the BSP that was built from exactly these inputs, if any; with the
+// cache locked.
+static CachedBsp *FindCachedBsp(uint64_t hash, const std::vector<uint64_t> &inputs) {
+    auto range = BspCache.equal_range(hash);
+    for(auto it = range.first; it != range.second; ++it) {
+        if(it->second.inputs == inputs) return &it->second;
+    }
+    return NULL;
+}
+
+static int CountBspNodes(const SBspUv *bsp) {
+    if(!bsp) return 0;
+    return 1 + CountBspNodes(bsp->pos) + CountBspNodes(bsp->neg) +
+               CountBspNodes(bsp->more);
+}
+
+static SBspUv *CopyBspInto(const SBspUv *bsp, SBspUv *nodes, int *n) {
+    if(!bsp) return NULL;
+    SBspUv *copy = &nodes[(*n)++];
+    copy->a    = bsp->a;
+    copy->b    = bsp->b;
+    copy->pos  = CopyBspInto(bsp->pos,  nodes, n);
+    copy->neg  = CopyBspInto(bsp->neg,  nodes, n);
+    copy->more = CopyBspInto(bsp->more, nodes, n);
+    return copy;
+}
+
+void SBspUv::ForgetUnused() {
+    std::lock_guard<std::mutex> lock(BspCacheMutex);
+    for(auto it = BspCache.begin(); it != BspCache.end();) {
+        if(it->second.used) {
+            it->second.used = false;
+            ++it;
+        } else {
+            if(it->second.nodes) MemFree(it->second.nodes);
+            MemoryUsage::Count(MemoryTag::BSP, it->second.counted, /*allocated=*/false);
+            it = BspCache.erase(it);
+        }
+    }
+}
+
 void SSurface::MakeClassifyingBsp(SShell *shell, SShell *useCurvesFrom) {
-    SEdgeList el = {};
+    static thread_local std::vector<uint64_t> inputs;
+    GetBspInputs(this, shell, useCurvesFrom, &inputs);
+    uint64_t hash = HashBspInputs(inputs);
+    bool found = false;
+    {
+        std::lock_guard<std::mutex> lock(BspCacheMutex);
+        if(CachedBsp *cb = FindCachedBsp(hash, inputs)) {
+            cb->used = true;
+            bsp = cb->nodes;
+            found = true;
+        }
+    }
 
-    MakeEdgesInto(shell, &el, MakeAs::UV, useCurvesFrom);
-    bsp = SBspUv::From(&el, this);
-    el.Clear();
+    if(!found) {
+        TempScope scope;
+        SEdgeList el = {};
+        MakeEdgesInto(shell, &el, MakeAs::UV, useCurvesFrom);
+        SBspUv *tmp = SBspUv::From(&el, this);
+        el.Clear();
+
+        // Copy it out of the temporary heap, so that it's kept.
+        int n = CountBspNodes(tmp);
+        SBspUv *nodes = NULL;
+        if(n > 0) {
+            MemoryTagScope tag(MemoryTag::BSP);
+            nodes = (SBspUv *)MemAlloc(n * sizeof(SBspUv));
+            n = 0;
+            CopyBspInto(tmp, nodes, &n);
+        }
+
+        // Another thread might have made the same one meanwhile; if so, use
+        // that one, so that everyone agrees.
+        std::lock_guard<std::mutex> lock(BspCacheMutex);
+        CachedBsp *cb = FindCachedBsp(hash, inputs);
+        if(cb) {
+            if(nodes) MemFree(nodes);
+            cb->used = true;
+        } else {
+            // The inputs are kept in a vector, not from MemAlloc(), so
+            // they're counted separately.
+            size_t counted = MemoryUsage::IsEnabled() ?
+                             inputs.size() * sizeof(uint64_t) : 0;
+            MemoryUsage::Count(MemoryTag::BSP, counted, /*allocated=*/true);
+            cb = &BspCache.emplace(hash, CachedBsp { inputs, counted, nodes, true })
+                          ->second;
+        }
+        bsp = cb->nodes;
+    }
 
     edges = {};
     MakeEdgesInto(shell, &edges, MakeAs::XYZ, useCurvesFrom);
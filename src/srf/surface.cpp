@@ -205,6 +205,93 @@ void SSurface::GetAxisAlignedBounding(Vector *ptMax, Vector *ptMin) const {
     }
 }
 
+//-----------------------------------------------------------------------------
+// Build the hierarchy top down, splitting each node's surfaces in half along
+// the longest axis of their boxes' centers, until there are only a few left.
+//-----------------------------------------------------------------------------
+void SSurfaceBvh::Build(const SShell *shell) {
+    node.clear();
+    order.clear();
+    srfMax.resize(shell->surface.n);
+    srfMin.resize(shell->surface.n);
+    for(int i = 0; i < shell->surface.n; i++) {
+        shell->surface.elem[i].GetAxisAlignedBounding(&srfMax[i], &srfMin[i]);
+        order.push_back(i);
+    }
+    if(!order.empty()) {
+        node.reserve(2*order.size());
+        BuildNode(0, (int)order.size());
+    }
+}
+
+int SSurfaceBvh::BuildNode(int first, int count) {
+    static const int LEAF_SIZE = 4;
+
+    Node n = {};
+    n.max = Vector::From(VERY_NEGATIVE, VERY_NEGATIVE, VERY_NEGATIVE);
+    n.min = Vector::From(VERY_POSITIVE, VERY_POSITIVE, VERY_POSITIVE);
+    Vector cmax = n.max, cmin = n.min;
+    for(int i = first; i < first + count; i++) {
+        int s = order[i];
+        srfMax[s].MakeMaxMin(&n.max, &n.min);
+        srfMin[s].MakeMaxMin(&n.max, &n.min);
+        Vector c = srfMax[s].Plus(srfMin[s]).ScaledBy(0.5);
+        c.MakeMaxMin(&cmax, &cmin);
+    }
+    n.first = first;
+    n.count = count;
+    n.left  = -1;
+    n.right = -1;
+
+    int self = (int)node.size();
+    node.push_back(n);
+    if(count <= LEAF_SIZE) return self;
+
+    Vector extent = cmax.Minus(cmin);
+    int axis = 0;
+    if(extent.Element(1) > extent.Element(axis)) axis = 1;
+    if(extent.Element(2) > extent.Element(axis)) axis = 2;
+
+    int half = count / 2;
+    std::nth_element(order.begin() + first, order.begin() + first + half,
+                     order.begin() + first + count, [&](int a, int b) {
+        return srfMax[a].Element(axis) + srfMin[a].Element(axis) <
+               srfMax[b].Element(axis) + srfMin[b].Element(axis);
+    });
+    int left  = BuildNode(first, half);
+    int right = BuildNode(first + half, count - half);
+    node[self].left  = left;
+    node[self].right = right;
+    return self;
+}
+
+void SSurfaceBvh::FindOverlapping(Vector max, Vector min,
+                                  std::vector<int> *out) const
+{
+    if(node.empty()) return;
+
+    size_t start = out->size();
+    int stack[64], depth = 0;
+    stack[depth++] = 0;
+    while(depth > 0) {
+        const Node *n = &node[stack[--depth]];
+        if(Vector::BoundingBoxesDisjoint(n->max, n->min, max, min)) continue;
+
+        if(n->left < 0) {
+            for(int i = n->first; i < n->first + n->count; i++) {
+                int s = order[i];
+                if(Vector::BoundingBoxesDisjoint(srfMax[s], srfMin[s], max, min))
+                    continue;
+                out->push_back(s);
+            }
+        } else {
+            stack[depth++] = n->left;
+            stack[depth++] = n->right;
+        }
+    }
+    std::sort(out->begin() + start, out->end());
+}
+
 bool SSurface::LineEntirelyOutsideBbox(Vector a, Vector b, bool asSegment) const {
     Vector amax, amin;
     GetAxisAlignedBounding(&amax, &amin);
@@ -880,6 +967,17 @@ bool SShell::IsEmpty() const {
     return (surface.n == 0);
 }
 
+void SShell::GetBounding(Vector *vmax, Vector *vmin) const {
+    *vmax = Vector::From(VERY_NEGATIVE, VERY_NEGATIVE, VERY_NEGATIVE);
+    *vmin = Vector::From(VERY_POSITIVE, VERY_POSITIVE, VERY_POSITIVE);
+    for(int i = 0; i < surface.n; i++) {
+        Vector smax, smin;
+        surface.elem[i].GetAxisAlignedBounding(&smax, &smin);
+        smax.MakeMaxMin(vmax, vmin);
+        smin.MakeMaxMin(vmax, vmin);
+    }
+}
+
 void SShell::Clear() {
     SSurface *s;
     for(s = surface.First(); s; s = surface.NextAfter(s)) {
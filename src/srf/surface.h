@@ -51,6 +51,10 @@ public:
     Class ClassifyPoint(Point2d p, Point2d eb, SSurface *srf) const;
     Class ClassifyEdge(Point2d ea, Point2d eb, SSurface *srf) const;
     double MinimumDistanceToEdge(Point2d p, SSurface *srf) const;
+
+    // The classifying BSPs of surfaces are kept between Booleans; forget the
+    // ones that haven't been used since the last time this was called.
+    static void ForgetUnused();
 };
 
 // Now the data structures to represent a shell of trimmed rational polynomial
@@ -276,7 +280,7 @@ public:
     SEdgeList       edges;
 
     // For caching our initial (u, v) when doing Newton iterations to project
-    // a point into our surface.
+    // a point into our surface, unless an SSurfaceGuesses is in scope.
     Point2d         cached;
 
     static SSurface FromExtrusionOf(SBezier *spc, Vector t0, Vector t1);
@@ -295,12 +299,12 @@ public:
                                   SShell *shell, SShell *sha, SShell *shb);
     void FindChainAvoiding(SEdgeList *src, SEdgeList *dest, SPointList *avoid);
     SSurface MakeCopyTrimAgainst(SShell *parent, SShell *a, SShell *b,
-                                    SShell *into, SSurface::CombineAs type);
+                                    SShell *into, SSurface::CombineAs type,
+                                    int index, bool *failed);
     void TrimFromEdgeList(SEdgeList *el, bool asUv);
     void IntersectAgainst(SSurface *b, SShell *agnstA, SShell *agnstB,
                           SShell *into);
-    void AddExactIntersectionCurve(SBezier *sb, SSurface *srfB,
-                          SShell *agnstA, SShell *agnstB, SShell *into);
+    void AddExactIntersectionCurve(SBezier *sb, SSurface *srfB, SShell *into);
 
     typedef struct {
         int     tag;
@@ -365,6 +369,53 @@ public:
     void Clear();
 };
 
+// SSurface::ClosestPointTo starts from the last point that it found on the
+// same surface. While one of these is in scope, those guesses are kept here,
+// for this thread alone, instead of in the surfaces themselves; so that many
+// threads can find points on the same surfaces at once, each getting the
+// same results no matter what the others have done.
+class SSurfaceGuesses {
+public:
+    SSurfaceGuesses();
+    ~SSurfaceGuesses();
+    SSurfaceGuesses(const SSurfaceGuesses &) = delete;
+    SSurfaceGuesses &operator=(const SSurfaceGuesses &) = delete;
+
+    // Where the guess for srf is kept, on this thread.
+    static Point2d *For(SSurface *srf);
+
+private:
+    std::unordered_map<const SSurface *, Point2d>   guess;
+    SSurfaceGuesses                                 *prev;
+};
+
+// A bounding volume hierarchy over the axis aligned bounding boxes of the
+// surfaces of a shell, to find the surfaces that might touch something
+// without testing every one of them.
+class SSurfaceBvh {
+public:
+    struct Node {
+        Vector      max, min;
+        // The children, or for a leaf, -1; and then the surfaces of the leaf
+        // are those in order[first] to order[first + count - 1].
+        int         left, right;
+        int         first, count;
+    };
+
+    std::vector<Node>   node;
+    std::vector<int>    order;
+    // The bounding box of each surface, by its index in the shell.
+    std::vector<Vector> srfMax, srfMin;
+
+    void Build(const SShell *shell);
+    // Append the indices of the surfaces whose bounding boxes aren't
+    // disjoint from the given one, in increasing order.
+    void FindOverlapping(Vector max, Vector min, std::vector<int> *out) const;
+
+private:
+    int BuildNode(int first, int count);
+};
+
 class SShell {
 public:
     IdList<SCurve,hSCurve>      curve;
@@ -383,6 +434,7 @@ public:
     void CopyCurvesSplitAgainst(bool opA, SShell *agnst, SShell *into);
     void CopySurfacesTrimAgainst(SShell *sha, SShell *shb, SShell *into, SSurface::CombineAs type);
     void MakeIntersectionCurvesAgainst(SShell *against, SShell *into);
+    void AddIntersectionCurve(SCurve *sc, bool isSplit, SShell *agnstA, SShell *agnstB);
     void MakeClassifyingBsps(SShell *useCurvesFrom);
     void AllPointsIntersecting(Vector a, Vector b, List<SInter> *il,
                                 bool asSegment, bool trimmed, bool inclTangent);
@@ -419,6 +471,7 @@ public:
     void MakeEdgesInto(SEdgeList *sel);
     void MakeSectionEdgesInto(Vector n, double d, SEdgeList *sel, SBezierList *sbl);
     bool IsEmpty() const;
+    void GetBounding(Vector *vmax, Vector *vmin) const;
     void RemapFaces(Group *g, int remap);
     void Clear();
 };
@@ -9,9 +9,13 @@
 
 extern int FLAG;
 
-void SSurface::AddExactIntersectionCurve(SBezier *sb, SSurface *srfB,
-                                         SShell *agnstA, SShell *agnstB, SShell *into)
-{
+//-----------------------------------------------------------------------------
+// Piecewise linearize an exact intersection curve. It's not split yet where
+// it intersects the surfaces of the shells, since if it's identical to a
+// curve that's already there then it follows that one's pwl instead; so
+// SShell::MakeIntersectionCurvesAgainst splits it once that's known.
+//-----------------------------------------------------------------------------
+void SSurface::AddExactIntersectionCurve(SBezier *sb, SSurface *srfB, SShell *into) {
     SCurve sc = {};
     // Important to keep the order of (surfA, surfB) consistent; when we later
     // rewrite the identifiers, we rewrite surfA from A and surfB from B.
@@ -20,88 +24,13 @@ void SSurface::AddExactIntersectionCurve(SBezier *sb, SSurface *srfB,
     sc.exact = *sb;
     sc.isExact = true;
 
-    // Now we have to piecewise linearize the curve. If there's already an
-    // identical curve in the shell, then follow that pwl exactly, otherwise
-    // calculate from scratch.
-    SCurve split, *existing = NULL, *se;
-    SBezier sbrev = *sb;
-    sbrev.Reverse();
-    bool backwards = false;
-    for(se = into->curve.First(); se; se = into->curve.NextAfter(se)) {
-        if(se->isExact) {
-            if(sb->Equals(&(se->exact))) {
-                existing = se;
-                break;
-            }
-            if(sbrev.Equals(&(se->exact))) {
-                existing = se;
-                backwards = true;
-                break;
-            }
-        }
-    }
-    if(existing) {
-        SCurvePt *v;
-        for(v = existing->pts.First(); v; v = existing->pts.NextAfter(v)) {
-            sc.pts.Add(v);
-        }
-        if(backwards) sc.pts.Reverse();
-        split = sc;
-        sc = {};
-    } else {
-        sb->MakePwlInto(&(sc.pts));
-        // and split the line where it intersects our existing surfaces
-        split = sc.MakeCopySplitAgainst(agnstA, agnstB, this, srfB);
-        sc.Clear();
-    }
+    sb->MakePwlInto(&(sc.pts));
 
-    // Test if the curve lies entirely outside one of the
-    SCurvePt *scpt;
-    bool withinA = false, withinB = false;
-    for(scpt = split.pts.First(); scpt; scpt = split.pts.NextAfter(scpt)) {
-        double tol = 0.01;
-        Point2d puv;
-        ClosestPointTo(scpt->p, &puv);
-        if(puv.x > -tol && puv.x < 1 + tol &&
-           puv.y > -tol && puv.y < 1 + tol)
-        {
-            withinA = true;
-        }
-        srfB->ClosestPointTo(scpt->p, &puv);
-        if(puv.x > -tol && puv.x < 1 + tol &&
-           puv.y > -tol && puv.y < 1 + tol)
-        {
-            withinB = true;
-        }
-        // Break out early, no sense wasting time if we already have the answer.
-        if(withinA && withinB) break;
-    }
-    if(!(withinA && withinB)) {
-        // Intersection curve lies entirely outside one of the surfaces, so
-        // it's fake.
-        split.Clear();
-        return;
-    }
-
-#if 0
-    if(sb->deg == 2) {
-        dbp(" ");
-        SCurvePt *prev = NULL, *v;
-        dbp("split.pts.n = %d", split.pts.n);
-        for(v = split.pts.First(); v; v = split.pts.NextAfter(v)) {
-            if(prev) {
-                Vector e = (prev->p).Minus(v->p).WithMagnitude(0);
-                SS.nakedEdges.AddEdge((prev->p).Plus(e), (v->p).Minus(e));
-            }
-            prev = v;
-        }
-    }
-#endif // 0
     ssassert(!(sb->Start()).Equals(sb->Finish()),
              "Unexpected zero-length edge");
 
-    split.source = SCurve::Source::INTERSECTION;
-    into->curve.AddAndAssignId(&split);
+    sc.source = SCurve::Source::INTERSECTION;
+    into->curve.AddAndAssignId(&sc);
 }
 
 void SSurface::IntersectAgainst(SSurface *b, SShell *agnstA, SShell *agnstB,
@@ -179,7 +108,7 @@ void SSurface::IntersectAgainst(SSurface *b, SShell *agnstA, SShell *agnstB,
         if(tmax > tmin + LENGTH_EPS) {
             SBezier bezier = SBezier::From(p.Plus(dl.ScaledBy(tmin)),
                                            p.Plus(dl.ScaledBy(tmax)));
-            AddExactIntersectionCurve(&bezier, b, agnstA, agnstB, into);
+            AddExactIntersectionCurve(&bezier, b, into);
         }
     } else if((degm == 1 && degn == 1 && isExtdb) ||
               (b->degm == 1 && b->degn == 1 && isExtdt))
@@ -224,7 +153,7 @@ void SSurface::IntersectAgainst(SSurface *b, SShell *agnstA, SShell *agnstB,
                 Vector al = along.ScaledBy(0.5);
                 SBezier bezier;
                 bezier = SBezier::From((si->p).Minus(al), (si->p).Plus(al));
-                AddExactIntersectionCurve(&bezier, b, agnstA, agnstB, into);
+                AddExactIntersectionCurve(&bezier, b, into);
             }
 
             inters.Clear();
@@ -240,7 +169,7 @@ void SSurface::IntersectAgainst(SSurface *b, SShell *agnstA, SShell *agnstB,
                     Vector::AtIntersectionOfPlaneAndLine(n, d, p0, p1, NULL);
             }
 
-            AddExactIntersectionCurve(&bezier, b, agnstA, agnstB, into);
+            AddExactIntersectionCurve(&bezier, b, into);
         }
     } else if(isExtdt && isExtdb &&
                 sqrt(fabs(alongt.Dot(alongb))) >
@@ -301,7 +230,7 @@ void SSurface::IntersectAgainst(SSurface *b, SShell *agnstA, SShell *agnstB,
 
             SBezier bezier;
             bezier = SBezier::From(p.Plus(axis0), p.Plus(axis1));
-            AddExactIntersectionCurve(&bezier, b, agnstA, agnstB, into);
+            AddExactIntersectionCurve(&bezier, b, into);
         }
 
         inters.Clear();
@@ -19,59 +19,144 @@ const double System::RANK_MAG_TOLERANCE = 1e-4;
 // always be much less than LENGTH_EPS, and in practice should be much less.
 const double System::CONVERGE_TOLERANCE = (LENGTH_EPS/(1e2));
 
-bool System::WriteJacobian(int tag) {
-    int a, i, j;
-
-    j = 0;
-    for(a = 0; a < param.n; a++) {
-        if(j >= MAX_UNKNOWNS) return false;
-
-        Param *p = &(param.elem[a]);
-        if(p->tag != tag) continue;
-        mat.param[j] = p->h;
-        j++;
+void System::WriteJacobian(int tag, Matrix *mat) {
+    std::vector<int> eqs, params;
+    for(int a = 0; a < param.n; a++) {
+        if(param.elem[a].tag == tag) params.push_back(a);
     }
-    mat.n = j;
-
-    i = 0;
-    for(a = 0; a < eq.n; a++) {
-        if(i >= MAX_UNKNOWNS) return false;
+    for(int a = 0; a < eq.n; a++) {
+        if(eq.elem[a].tag == tag) eqs.push_back(a);
+    }
+    WriteJacobian(eqs, params, mat);
+}
 
+void System::WriteJacobian(const std::vector<int> &eqs, const std::vector<int> &params,
+                           Matrix *mat) {
+    // The unknowns are given by their index in the param list, in order,
+    // so the column of each one can be found by binary search.
+    mat->param.clear();
+    for(int a : params) {
+        mat->param.push_back(param.elem[a].h);
+    }
+    mat->n = (int)mat->param.size();
+
+    mat->eq.clear();
+    mat->A.rowStart.clear();
+    mat->A.col.clear();
+    mat->A.reg.clear();
+    mat->B.reg.clear();
+    mat->prog.Clear();
+    mat->depStart.clear();
+    mat->dep.clear();
+
+    std::vector<std::pair<int, int>> cols;
+    for(int a : eqs) {
         Equation *e = &(eq.elem[a]);
-        if(e->tag != tag) continue;
-
-        mat.eq[i] = e->h;
+        mat->eq.push_back(e->h);
         Expr *f = e->e->DeepCopyWithParamsAsPointers(&param, &(SK.param));
         f = f->FoldConstants();
+        int r = mat->prog.Add(f);
+        mat->B.reg.push_back(r);
+
+        // The partials come from the instructions that the equation depends
+        // on, and only the unknowns among those can have a nonzero partial,
+        // so don't bother with any others.
+        int start = (int)mat->dep.size();
+        mat->depStart.push_back(start);
+        mat->prog.Dependencies(r, &mat->dep);
+        cols.clear();
+        for(size_t k = start; k < mat->dep.size(); k++) {
+            const ExprProgram::Instruction &in = mat->prog.code[mat->dep[k]];
+            if(in.op != Expr::Op::PARAM_PTR) continue;
+
+            hParam hp = in.parp->h;
+            auto it = std::lower_bound(params.begin(), params.end(), param.IndexOf(hp));
+            if(it != params.end() && param.elem[*it].h.v == hp.v) {
+                cols.emplace_back((int)(it - params.begin()), mat->dep[k]);
+            }
+        }
+        std::sort(cols.begin(), cols.end());
 
-        // Hash table (61 bits) to accelerate generation of zero partials.
-        uint64_t scoreboard = f->ParamsUsed();
-        for(j = 0; j < mat.n; j++) {
-            Expr *pd;
-            if(scoreboard & ((uint64_t)1 << (mat.param[j].v % 61)) &&
-                f->DependsOn(mat.param[j]))
-            {
-                pd = f->PartialWrt(mat.param[j]);
-                pd = pd->FoldConstants();
-                pd = pd->DeepCopyWithParamsAsPointers(&param, &(SK.param));
-            } else {
-                pd = Expr::From(0.0);
+        mat->A.rowStart.push_back((int)mat->A.col.size());
+        for(const std::pair<int, int> &jr : cols) {
+            mat->A.col.push_back(jr.first);
+            mat->A.reg.push_back(jr.second);
+        }
+    }
+    mat->depStart.push_back((int)mat->dep.size());
+    mat->m = (int)mat->eq.size();
+    mat->A.rowStart.push_back((int)mat->A.col.size());
+    mat->A.num.resize(mat->A.col.size());
+    mat->B.num.resize(mat->m);
+    mat->scale.resize(mat->n);
+    mat->X.resize(mat->n);
+    mat->Z.resize(mat->m);
+
+    // The sparsity pattern of A*A' is fixed now too: row r has an entry in
+    // column c wherever rows r and c of A share an unknown. So find that,
+    // by way of the rows that use each column.
+    std::vector<int> colStart(mat->n + 1, 0), colRow(mat->A.col.size());
+    for(int j : mat->A.col) {
+        colStart[j + 1]++;
+    }
+    for(int j = 0; j < mat->n; j++) {
+        colStart[j + 1] += colStart[j];
+    }
+    std::vector<int> colNext(colStart.begin(), colStart.end() - 1);
+    for(int r = 0; r < mat->m; r++) {
+        for(int p = mat->A.rowStart[r]; p < mat->A.rowStart[r+1]; p++) {
+            colRow[colNext[mat->A.col[p]]++] = r;
+        }
+    }
+
+    SparseSymmetricMatrix *AAt = &(mat->AAt);
+    AAt->n = mat->m;
+    AAt->rowStart.clear();
+    AAt->col.clear();
+    std::vector<int> flag(mat->m, -1);
+    for(int r = 0; r < mat->m; r++) {
+        int start = (int)AAt->col.size();
+        AAt->rowStart.push_back(start);
+        for(int p = mat->A.rowStart[r]; p < mat->A.rowStart[r+1]; p++) {
+            int j = mat->A.col[p];
+            for(int q = colStart[j]; q < colStart[j+1]; q++) {
+                int c = colRow[q];
+                if(c > r) break; // lower triangle only
+                if(flag[c] == r) continue;
+                flag[c] = r;
+                AAt->col.push_back(c);
             }
-            mat.A.sym[i][j] = pd;
         }
-        mat.B.sym[i] = f;
-        i++;
+        // An equation with no unknowns still gets its (zero) diagonal.
+        if(flag[r] != r) AAt->col.push_back(r);
+        std::sort(AAt->col.begin() + start, AAt->col.end());
     }
-    mat.m = i;
+    AAt->rowStart.push_back((int)AAt->col.size());
+    AAt->val.resize(AAt->col.size());
+    AAt->Analyze();
+}
 
-    return true;
+void System::EvalJacobian(Matrix *mat) {
+    EvalResiduals(mat);
+    EvalPartials(mat);
+}
+
+void System::EvalResiduals(Matrix *mat) {
+    mat->prog.Eval();
+    for(int i = 0; i < mat->m; i++) {
+        mat->B.num[i] = mat->prog.reg[mat->B.reg[i]];
+    }
 }
 
-void System::EvalJacobian() {
-    int i, j;
-    for(i = 0; i < mat.m; i++) {
-        for(j = 0; j < mat.n; j++) {
-            mat.A.num[i][j] = (mat.A.sym[i][j])->Eval();
+void System::EvalPartials(Matrix *mat) {
+    // Each row of the Jacobian is the gradient of its equation, which we
+    // get in one go by reverse mode automatic differentiation.
+    for(int i = 0; i < mat->m; i++) {
+        const int *dep = &mat->dep[mat->depStart[i]];
+        int n = mat->depStart[i+1] - mat->depStart[i];
+        mat->prog.Gradient(mat->B.reg[i], dep, n);
+        for(int p = mat->A.rowStart[i]; p < mat->A.rowStart[i+1]; p++) {
+            mat->A.num[p] = mat->prog.adj[mat->A.reg[p]];
         }
     }
 }
@@ -84,9 +169,46 @@ bool System::IsDragged(hParam p) {
     return false;
 }
 
+bool System::IsAnyDragged(Subsystem *ss) {
+    // A dragged unknown always stays when others are substituted for it, so
+    // it's enough to look at the ones that are left.
+    for(int j : ss->param) {
+        if(IsDragged(param.elem[j].h)) return true;
+    }
+    return false;
+}
+
+bool System::IsSatisfied(Matrix *mat) {
+    EvalResiduals(mat);
+    for(int i = 0; i < mat->m; i++) {
+        if(!(ffabs(mat->B.num[i]) <= CONVERGE_TOLERANCE)) return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Eliminate the equations of the form a - b = 0, by replacing a with b
+// everywhere else. The unknowns that are set equal form equivalence classes,
+// found with a union-find; each class is then replaced by one member, and
+// the other equations are rewritten once, at the end.
+//-----------------------------------------------------------------------------
 void System::SolveBySubstitution() {
-    int i;
-    for(i = 0; i < eq.n; i++) {
+    // The union-find is over the unknowns, by their index in the param list;
+    // the root of each set is the unknown that replaces all the others.
+    std::vector<int> root(param.n);
+    for(int i = 0; i < param.n; i++) {
+        root[i] = i;
+    }
+    auto findRoot = [&](int i) {
+        while(root[i] != i) {
+            root[i] = root[root[i]];
+            i = root[i];
+        }
+        return i;
+    };
+
+    bool any = false;
+    for(int i = 0; i < eq.n; i++) {
         Equation *teq = &(eq.elem[i]);
         Expr *tex = teq->e;
 
@@ -94,233 +216,282 @@ void System::SolveBySubstitution() {
            tex->a->op == Expr::Op::PARAM &&
            tex->b->op == Expr::Op::PARAM)
         {
-            hParam a = tex->a->parh;
-            hParam b = tex->b->parh;
-            if(!(param.FindByIdNoOops(a) && param.FindByIdNoOops(b))) {
+            int a = param.IndexOf(tex->a->parh);
+            int b = param.IndexOf(tex->b->parh);
+            if(a < 0 || b < 0) {
                 // Don't substitute unless they're both solver params;
                 // otherwise it's an equation that can be solved immediately,
                 // or an error to flag later.
                 continue;
             }
 
-            if(IsDragged(a)) {
-                // A is being dragged, so A should stay, and B should go
-                hParam t = a;
-                a = b;
-                b = t;
+            a = findRoot(a);
+            b = findRoot(b);
+            if(a == b) {
+                // Already equal, as with a duplicate horizontal constraint.
+                // So this is satisfied along with the equations that made
+                // them equal, and goes too; otherwise it'd be left as 0 = 0,
+                // and the rank test would call it redundant.
+                teq->tag = EQ_SUBSTITUTED;
+                continue;
             }
 
-            int j;
-            for(j = 0; j < eq.n; j++) {
-                Equation *req = &(eq.elem[j]);
-                (req->e)->Substitute(a, b); // A becomes B, B unchanged
-            }
-            for(j = 0; j < param.n; j++) {
-                Param *rp = &(param.elem[j]);
-                if(rp->substd.v == a.v) {
-                    rp->substd = b;
-                }
+            if(IsDragged(param.elem[a].h)) {
+                // A is being dragged, so A should stay, and B should go
+                std::swap(a, b);
             }
-            Param *ptr = param.FindById(a);
-            ptr->tag = VAR_SUBSTITUTED;
-            ptr->substd = b;
-
+            root[a] = b; // A becomes B, B unchanged
             teq->tag = EQ_SUBSTITUTED;
+            any = true;
         }
     }
-}
+    if(!any) return;
 
-//-----------------------------------------------------------------------------
-// Calculate the rank of the Jacobian matrix, by Gram-Schimdt orthogonalization
-// in place. A row (~equation) is considered to be all zeros if its magnitude
-// is less than the tolerance RANK_MAG_TOLERANCE.
-//-----------------------------------------------------------------------------
-int System::CalculateRank() {
-    // Actually work with magnitudes squared, not the magnitudes
-    double rowMag[MAX_UNKNOWNS] = {};
-    double tol = RANK_MAG_TOLERANCE*RANK_MAG_TOLERANCE;
-
-    int i, iprev, j;
-    int rank = 0;
-
-    for(i = 0; i < mat.m; i++) {
-        // Subtract off this row's component in the direction of any
-        // previous rows
-        for(iprev = 0; iprev < i; iprev++) {
-            if(rowMag[iprev] <= tol) continue; // ignore zero rows
+    std::unordered_map<uint32_t, hParam> subst;
+    for(int i = 0; i < param.n; i++) {
+        int r = findRoot(i);
+        if(r == i) continue;
 
-            double dot = 0;
-            for(j = 0; j < mat.n; j++) {
-                dot += (mat.A.num[iprev][j]) * (mat.A.num[i][j]);
-            }
-            for(j = 0; j < mat.n; j++) {
-                mat.A.num[i][j] -= (dot/rowMag[iprev])*mat.A.num[iprev][j];
-            }
-        }
-        // Our row is now normal to all previous rows; calculate the
-        // magnitude of what's left
-        double mag = 0;
-        for(j = 0; j < mat.n; j++) {
-            mag += (mat.A.num[i][j]) * (mat.A.num[i][j]);
-        }
-        if(mag > tol) {
-            rank++;
-        }
-        rowMag[i] = mag;
+        Param *p = &(param.elem[i]);
+        p->tag = VAR_SUBSTITUTED;
+        p->substd = param.elem[r].h;
+        subst[p->h.v] = p->substd;
     }
 
-    return rank;
+    std::unordered_map<const Expr *, Expr *> memo;
+    for(int i = 0; i < eq.n; i++) {
+        Equation *req = &(eq.elem[i]);
+        if(req->tag == EQ_SUBSTITUTED) continue;
+        req->e = req->e->Substitute(subst, &memo);
+    }
 }
 
-bool System::TestRank() {
-    EvalJacobian();
-    return CalculateRank() == mat.m;
+//-----------------------------------------------------------------------------
+// Calculate the rank of the Jacobian matrix. Factoring A*A' in natural order
+// amounts to Gram-Schmidt orthogonalization of the rows of A, with D holding
+// the magnitude squared of what's left of each row; so a row (~equation) is
+// considered to be all zeros if that's less than RANK_MAG_TOLERANCE squared.
+//-----------------------------------------------------------------------------
+int System::CalculateRank(Matrix *mat) {
+    WriteNormalMatrix(mat);
+    mat->AAt.Factor(RANK_MAG_TOLERANCE*RANK_MAG_TOLERANCE);
+    return mat->m - mat->AAt.zeroPivots;
 }
 
-bool System::SolveLinearSystem(double X[], double A[][MAX_UNKNOWNS],
-                               double B[], int n)
-{
-    // Gaussian elimination, with partial pivoting. It's an error if the
-    // matrix is singular, because that means two constraints are
-    // equivalent.
-    int i, j, ip, jp, imax = 0;
-    double max, temp;
-
-    for(i = 0; i < n; i++) {
-        // We are trying eliminate the term in column i, for rows i+1 and
-        // greater. First, find a pivot (between rows i and N-1).
-        max = 0;
-        for(ip = i; ip < n; ip++) {
-            if(ffabs(A[ip][i]) > max) {
-                imax = ip;
-                max = ffabs(A[ip][i]);
-            }
-        }
-        // Don't give up on a singular matrix unless it's really bad; the
-        // assumption code is responsible for identifying that condition,
-        // so we're not responsible for reporting that error.
-        if(ffabs(max) < 1e-20) continue;
-
-        // Swap row imax with row i
-        for(jp = 0; jp < n; jp++) {
-            swap(A[i][jp], A[imax][jp]);
-        }
-        swap(B[i], B[imax]);
-
-        // For rows i+1 and greater, eliminate the term in column i.
-        for(ip = i+1; ip < n; ip++) {
-            temp = A[ip][i]/A[i][i];
+bool System::TestRank(Matrix *mat) {
+    EvalJacobian(mat);
+    return CalculateRank(mat) == mat->m;
+}
 
-            for(jp = i; jp < n; jp++) {
-                A[ip][jp] -= temp*(A[i][jp]);
+void System::WriteNormalMatrix(Matrix *mat) {
+    // Each entry of A*A' is the dot product of two rows of A; and both rows
+    // are sorted by column, so we can just merge them.
+    SparseSymmetricMatrix *AAt = &(mat->AAt);
+    for(int r = 0; r < mat->m; r++) {
+        for(int p = AAt->rowStart[r]; p < AAt->rowStart[r+1]; p++) {
+            int c = AAt->col[p];
+            int i    = mat->A.rowStart[r],
+                iend = mat->A.rowStart[r+1],
+                j    = mat->A.rowStart[c],
+                jend = mat->A.rowStart[c+1];
+            double sum = 0;
+            while(i < iend && j < jend) {
+                if(mat->A.col[i] < mat->A.col[j]) {
+                    i++;
+                } else if(mat->A.col[i] > mat->A.col[j]) {
+                    j++;
+                } else {
+                    sum += mat->A.num[i]*mat->A.num[j];
+                    i++;
+                    j++;
+                }
             }
-            B[ip] -= temp*B[i];
+            AAt->val[p] = sum;
         }
     }
-
-    // We've put the matrix in upper triangular form, so at this point we
-    // can solve by back-substitution.
-    for(i = n - 1; i >= 0; i--) {
-        if(ffabs(A[i][i]) < 1e-20) continue;
-
-        temp = B[i];
-        for(j = n - 1; j > i; j--) {
-            temp -= X[j]*A[i][j];
-        }
-        X[i] = temp / A[i][i];
-    }
-
-    return true;
 }
 
-bool System::SolveLeastSquares() {
-    int r, c, i;
+bool System::SolveLeastSquares(Matrix *mat, double lambda) {
+    int r, c;
 
     // Scale the columns; this scale weights the parameters for the least
     // squares solve, so that we can encourage the solver to make bigger
     // changes in some parameters, and smaller in others.
-    for(c = 0; c < mat.n; c++) {
-        if(IsDragged(mat.param[c])) {
+    for(c = 0; c < mat->n; c++) {
+        if(IsDragged(mat->param[c])) {
             // It's least squares, so this parameter doesn't need to be all
             // that big to get a large effect.
-            mat.scale[c] = 1/20.0;
+            mat->scale[c] = 1/20.0;
         } else {
-            mat.scale[c] = 1;
-        }
-        for(r = 0; r < mat.m; r++) {
-            mat.A.num[r][c] *= mat.scale[c];
+            mat->scale[c] = 1;
         }
     }
+    for(size_t i = 0; i < mat->A.num.size(); i++) {
+        mat->A.num[i] *= mat->scale[mat->A.col[i]];
+    }
 
-    // Write A*A'
-    for(r = 0; r < mat.m; r++) {
-        for(c = 0; c < mat.m; c++) {  // yes, AAt is square
-            double sum = 0;
-            for(i = 0; i < mat.n; i++) {
-                sum += mat.A.num[r][i]*mat.A.num[c][i];
-            }
-            mat.AAt[r][c] = sum;
+    // Write A*A', and solve (A*A') Z = B. Don't give up on a singular matrix
+    // unless it's really bad; the assumption code is responsible for
+    // identifying that condition, so we're not responsible for reporting
+    // that error.
+    WriteNormalMatrix(mat);
+    if(lambda > 0) {
+        // Damp the step, as for Levenberg-Marquardt; the diagonal is the
+        // last entry in each row.
+        SparseSymmetricMatrix *AAt = &(mat->AAt);
+        for(r = 0; r < mat->m; r++) {
+            AAt->val[AAt->rowStart[r+1] - 1] *= 1 + lambda;
         }
     }
-
-    if(!SolveLinearSystem(mat.Z, mat.AAt, mat.B.num, mat.m)) return false;
+    mat->AAt.Factor(1e-20);
+    mat->Z = mat->B.num;
+    mat->AAt.Solve(mat->Z.data());
 
     // And multiply that by A' to get our solution.
-    for(c = 0; c < mat.n; c++) {
-        double sum = 0;
-        for(i = 0; i < mat.m; i++) {
-            sum += mat.A.num[i][c]*mat.Z[i];
+    std::fill(mat->X.begin(), mat->X.end(), 0.0);
+    for(r = 0; r < mat->m; r++) {
+        for(int p = mat->A.rowStart[r]; p < mat->A.rowStart[r+1]; p++) {
+            mat->X[mat->A.col[p]] += mat->A.num[p]*mat->Z[r];
         }
-        mat.X[c] = sum * mat.scale[c];
+    }
+    for(c = 0; c < mat->n; c++) {
+        mat->X[c] *= mat->scale[c];
     }
     return true;
 }
 
-bool System::NewtonSolve(int tag) {
+bool System::NewtonSolve(Matrix *mat) {
 
     int iter = 0;
-    bool converged = false;
+    bool converged = false, diverged = false;
     int i;
 
-    // Evaluate the functions at our operating point.
-    for(i = 0; i < mat.m; i++) {
-        mat.B.num[i] = (mat.B.sym[i])->Eval();
+    // Remember where we started, in case we have to start over.
+    std::vector<double> start(mat->n);
+    for(i = 0; i < mat->n; i++) {
+        start[i] = param.FindById(mat->param[i])->val;
     }
+    mat->damped = false;
+
+    // Evaluate the functions at our operating point.
+    EvalResiduals(mat);
     do {
         // And evaluate the Jacobian at our initial operating point.
-        EvalJacobian();
+        EvalPartials(mat);
 
-        if(!SolveLeastSquares()) break;
+        if(!SolveLeastSquares(mat)) break;
 
         // Take the Newton step;
         //      J(x_n) (x_{n+1} - x_n) = 0 - F(x_n)
-        for(i = 0; i < mat.n; i++) {
-            Param *p = param.FindById(mat.param[i]);
-            p->val -= mat.X[i];
+        for(i = 0; i < mat->n; i++) {
+            Param *p = param.FindById(mat->param[i]);
+            p->val -= mat->X[i];
             if(isnan(p->val)) {
                 // Very bad, and clearly not convergent
-                return false;
+                diverged = true;
             }
         }
+        if(diverged) break;
 
         // Re-evalute the functions, since the params have just changed.
-        for(i = 0; i < mat.m; i++) {
-            mat.B.num[i] = (mat.B.sym[i])->Eval();
-        }
+        EvalResiduals(mat);
         // Check for convergence
         converged = true;
-        for(i = 0; i < mat.m; i++) {
-            if(isnan(mat.B.num[i])) {
-                return false;
+        for(i = 0; i < mat->m; i++) {
+            if(isnan(mat->B.num[i])) {
+                diverged = true;
+                break;
             }
-            if(ffabs(mat.B.num[i]) > CONVERGE_TOLERANCE) {
+            if(ffabs(mat->B.num[i]) > CONVERGE_TOLERANCE) {
+                converged = false;
+                break;
+            }
+        }
+    } while(iter++ < 50 && !converged && !diverged);
+
+    if(converged && !diverged) return true;
+
+    // Newton's method went off somewhere, so go back to where we started,
+    // and try again more carefully.
+    std::vector<double> newton(mat->n), newtonB = mat->B.num;
+    for(i = 0; i < mat->n; i++) {
+        Param *p = param.FindById(mat->param[i]);
+        newton[i] = p->val;
+        p->val = start[i];
+    }
+    mat->damped = true;
+    if(DampedSolve(mat)) return true;
+
+    // That didn't work either, so there's probably no solution at all; leave
+    // things as Newton's method did, which tends to leave the fewest
+    // equations unsatisfied, for ReportUnsatisfied().
+    for(i = 0; i < mat->n; i++) {
+        param.FindById(mat->param[i])->val = newton[i];
+    }
+    mat->B.num = newtonB;
+    return false;
+}
+
+double System::ResidualNorm(Matrix *mat) {
+    double sum = 0;
+    for(int i = 0; i < mat->m; i++) {
+        sum += mat->B.num[i]*mat->B.num[i];
+    }
+    return sqrt(sum);
+}
+
+//-----------------------------------------------------------------------------
+// Solve by Levenberg-Marquardt, which is slower than Newton's method but
+// converges from much further away. Each step is damped, by adding lambda
+// times the diagonal to A*A'; and it's taken only if it makes the residual
+// smaller, in which case lambda gets smaller, so we tend to Newton steps as
+// we get close. Otherwise, lambda gets bigger, and we try a shorter step
+// (that's closer to steepest descent) from the same place.
+//-----------------------------------------------------------------------------
+bool System::DampedSolve(Matrix *mat) {
+    std::vector<double> prev(mat->n);
+    double lambda = 1e-3;
+    int i;
+
+    EvalResiduals(mat);
+    double norm = ResidualNorm(mat);
+    if(isnan(norm)) return false;
+
+    for(int iter = 0; iter < 100; iter++) {
+        bool converged = true;
+        for(i = 0; i < mat->m; i++) {
+            if(ffabs(mat->B.num[i]) > CONVERGE_TOLERANCE) {
                 converged = false;
                 break;
             }
         }
-    } while(iter++ < 50 && !converged);
+        if(converged) return true;
+
+        EvalPartials(mat);
+        if(!SolveLeastSquares(mat, lambda)) break;
 
-    return converged;
+        for(i = 0; i < mat->n; i++) {
+            Param *p = param.FindById(mat->param[i]);
+            prev[i] = p->val;
+            p->val -= mat->X[i];
+        }
+        EvalResiduals(mat);
+        double newNorm = ResidualNorm(mat);
+        if(newNorm < norm) {
+            norm = newNorm;
+            lambda /= 10;
+        } else {
+            // That made things worse (or not a number), so go back.
+            for(i = 0; i < mat->n; i++) {
+                param.FindById(mat->param[i])->val = prev[i];
+            }
+            EvalResiduals(mat);
+            lambda *= 10;
+            // We're not getting anywhere, even with tiny steps.
+            if(lambda > 1e10) break;
+        }
+    }
+    return false;
 }
 
 void System::WriteEquationsExceptFor(hConstraint hc, Group *g) {
@@ -359,11 +530,122 @@ void System::WriteEquationsExceptFor(hConstraint hc, Group *g) {
     g->GenerateEquations(&eq);
 }
 
-void System::FindWhichToRemoveToFixJacobian(Group *g, List<hConstraint> *bad, bool forceDofCheck) {
-    int a, i;
+//-----------------------------------------------------------------------------
+// Find the constraints that could each be removed to make the Jacobian full
+// rank. Each dropped pivot in the factorization of A*A' gives a vector y in
+// the null space of A', i.e. a combination of the equations that sums to
+// zero. With an orthonormal basis Y for all k of those vectors, the ones
+// that are left without a constraint's equations are the combinations of Y
+// that vanish on those rows; so there are k minus the rank of Y restricted
+// to those rows, and that's one factorization, instead of one for every
+// constraint.
+//
+// Without that constraint, the system is then full rank if those are all
+// just the dependencies that substitution would drop anyway: among the
+// equations a - b = 0, any that set two unknowns equal that are already
+// equal by way of the others. There's one of those for every cycle in the
+// graph of unknowns with an edge for each such equation, so count them.
+//-----------------------------------------------------------------------------
+void System::FindWhichToRemoveToFixJacobian(Group *g, List<hConstraint> *bad,
+                                            bool forceDofCheck) {
+    // Undo any substitutions, since the equations that those removed are
+    // needed too; the substituted unknowns were solved along with the one
+    // that replaced them.
+    for(int i = 0; i < param.n; i++) {
+        Param *p = &(param.elem[i]);
+        if(p->tag == VAR_SUBSTITUTED) {
+            p->val = param.FindById(p->substd)->val;
+        }
+    }
+    param.ClearTags();
+    eq.Clear();
+    WriteEquationsExceptFor(Constraint::NO_CONSTRAINT, g);
+    eq.ClearTags();
+
+    Matrix mat;
+    WriteJacobian(0, &mat);
+    EvalJacobian(&mat);
+    CalculateRank(&mat);
+
+    // Find the null space, and Gram-Schmidt it.
+    std::vector<std::vector<double>> Y;
+    for(int i = 0; i < mat.m; i++) {
+        if(mat.AAt.d[i] != 0) continue;
+        std::vector<double> y(mat.m);
+        mat.AAt.NullVector(i, &y[0]);
+        for(const std::vector<double> &u : Y) {
+            double dot = 0;
+            for(int r = 0; r < mat.m; r++) dot += u[r]*y[r];
+            for(int r = 0; r < mat.m; r++) y[r] -= dot*u[r];
+        }
+        double mag = 0;
+        for(int r = 0; r < mat.m; r++) mag += y[r]*y[r];
+        mag = sqrt(mag);
+        if(mag < RANK_MAG_TOLERANCE) continue;
+        for(int r = 0; r < mat.m; r++) y[r] /= mag;
+        Y.push_back(std::move(y));
+    }
+    int k = (int)Y.size();
+    if(k == 0) return;
 
-    for(a = 0; a < 2; a++) {
-        for(i = 0; i < SK.constraint.n; i++) {
+    std::unordered_map<uint32_t, std::vector<int>> rowsOf;
+    for(int r = 0; r < mat.m; r++) {
+        if(!mat.eq[r].isFromConstraint()) continue;
+        rowsOf[mat.eq[r].constraint().v].push_back(r);
+    }
+
+    // The equations that substitution would use, as edges between the
+    // unknowns that they set equal, and which constraint each came from.
+    struct Edge {
+        int         a, b;
+        uint32_t    constraint;
+    };
+    std::vector<Edge> edges;
+    if(!forceDofCheck) {
+        for(int i = 0; i < eq.n; i++) {
+            Expr *e = eq.elem[i].e;
+            if(e->op    != Expr::Op::MINUS ||
+               e->a->op != Expr::Op::PARAM ||
+               e->b->op != Expr::Op::PARAM) continue;
+
+            int a = param.IndexOf(e->a->parh),
+                b = param.IndexOf(e->b->parh);
+            if(a < 0 || b < 0) continue;
+            hEquation he = eq.elem[i].h;
+            edges.push_back({ a, b, he.isFromConstraint() ? he.constraint().v : 0 });
+        }
+    }
+    std::vector<int> root;
+    auto countCycles = [&](uint32_t except) {
+        root.resize(param.n);
+        for(int i = 0; i < param.n; i++) {
+            root[i] = i;
+        }
+        auto findRoot = [&](int i) {
+            while(root[i] != i) {
+                root[i] = root[root[i]];
+                i = root[i];
+            }
+            return i;
+        };
+        int cycles = 0;
+        for(const Edge &e : edges) {
+            if(e.constraint != 0 && e.constraint == except) continue;
+            int ra = findRoot(e.a),
+                rb = findRoot(e.b);
+            if(ra == rb) {
+                cycles++;
+            } else {
+                root[ra] = rb;
+            }
+        }
+        return cycles;
+    };
+    int cycles = countCycles(0);
+
+    std::vector<std::vector<double>> Yc(k);
+    for(int a = 0; a < 2; a++) {
+        for(int i = 0; i < SK.constraint.n; i++) {
             ConstraintBase *c = &(SK.constraint.elem[i]);
             if(c->group.v != g->h.v) continue;
             if((c->type == Constraint::Type::POINTS_COINCIDENT && a == 0) ||
@@ -375,47 +657,268 @@ void System::FindWhichToRemoveToFixJacobian(Group *g, List<hConstraint> *bad, bo
                 continue;
             }
 
-            param.ClearTags();
-            eq.Clear();
-            WriteEquationsExceptFor(c->h, g);
-            eq.ClearTags();
+            auto it = rowsOf.find(c->h.v);
+            if(it == rowsOf.end()) continue;
+            const std::vector<int> &rows = it->second;
+
+            // Gram-Schmidt the null vectors again, restricted to this
+            // constraint's equations, to find the rank of those.
+            int rank = 0;
+            for(int j = 0; j < k; j++) {
+                std::vector<double> &v = Yc[rank];
+                v.resize(rows.size());
+                for(size_t r = 0; r < rows.size(); r++) {
+                    v[r] = Y[j][rows[r]];
+                }
+                for(int l = 0; l < rank; l++) {
+                    double dot = 0;
+                    for(size_t r = 0; r < rows.size(); r++) dot += Yc[l][r]*v[r];
+                    for(size_t r = 0; r < rows.size(); r++) v[r] -= dot*Yc[l][r];
+                }
+                double mag = 0;
+                for(size_t r = 0; r < rows.size(); r++) mag += v[r]*v[r];
+                mag = sqrt(mag);
+                if(mag < RANK_MAG_TOLERANCE) continue;
+                for(size_t r = 0; r < rows.size(); r++) v[r] /= mag;
+                rank++;
+            }
+
+            bool hasEdge = false;
+            for(const Edge &e : edges) {
+                if(e.constraint == c->h.v) hasEdge = true;
+            }
+            int left = k - rank;
+            if(left == (hasEdge ? countCycles(c->h.v) : cycles)) {
+                // We can fix it by removing this constraint
+                bad->Add(&(c->h));
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Split the equations and unknowns that haven't been assigned to a subsystem
+// yet (tag 0) into independent subsystems, which can be solved separately;
+// two unknowns are in the same subsystem if any equation references both.
+// The subsystems are tagged in order starting from firstTag, which makes the
+// result depend on nothing but the order of the lists.
+//-----------------------------------------------------------------------------
+void System::FindSubsystems(int firstTag) {
+    // A union-find over the unknowns, by their index in the param list; the
+    // root of each set is always its first member.
+    std::vector<int> root(param.n);
+    for(int i = 0; i < param.n; i++) {
+        root[i] = i;
+    }
+    auto findRoot = [&](int i) {
+        while(root[i] != i) {
+            root[i] = root[root[i]];
+            i = root[i];
+        }
+        return i;
+    };
 
-            // It's a major speedup to solve the easy ones by substitution here,
-            // and that doesn't break anything.
-            if(!forceDofCheck) {
-                SolveBySubstitution();
+    std::vector<int> eqParam(eq.n, -1);
+    std::vector<hParam> used;
+    for(int a = 0; a < eq.n; a++) {
+        Equation *e = &(eq.elem[a]);
+        if(e->tag != 0) continue;
+
+        used.clear();
+        e->e->ParamsUsedList(&used);
+        for(hParam hp : used) {
+            int i = param.IndexOf(hp);
+            if(i < 0 || param.elem[i].tag != 0) continue;
+
+            if(eqParam[a] < 0) {
+                eqParam[a] = i;
+                continue;
             }
+            int ra = findRoot(eqParam[a]),
+                rb = findRoot(i);
+            if(ra < rb) {
+                root[rb] = ra;
+            } else if(rb < ra) {
+                root[ra] = rb;
+            }
+        }
+    }
 
-            WriteJacobian(0);
-            EvalJacobian();
+    subsys.clear();
+    std::vector<int> rootSubsys(param.n, -1);
+    for(int i = 0; i < param.n; i++) {
+        Param *p = &(param.elem[i]);
+        if(p->tag != 0) continue;
 
-            int rank = CalculateRank();
-            if(rank == mat.m) {
-                // We fixed it by removing this constraint
+        int r = findRoot(i);
+        if(rootSubsys[r] < 0) {
+            rootSubsys[r] = (int)subsys.size();
+            subsys.emplace_back();
+            subsys.back().tag = firstTag + rootSubsys[r];
+        }
+        Subsystem *ss = &subsys[rootSubsys[r]];
+        ss->param.push_back(i);
+        p->tag = ss->tag;
+    }
+    for(int a = 0; a < eq.n; a++) {
+        Equation *e = &(eq.elem[a]);
+        if(e->tag != 0) continue;
+
+        Subsystem *ss;
+        if(eqParam[a] >= 0) {
+            ss = &subsys[rootSubsys[findRoot(eqParam[a])]];
+        } else {
+            // An equation with no unknowns at all gets a subsystem of its
+            // own; the rank test will catch that.
+            subsys.emplace_back();
+            ss = &subsys.back();
+            ss->tag = firstTag + (int)subsys.size() - 1;
+        }
+        ss->eq.push_back(a);
+        e->tag = ss->tag;
+    }
+}
+
+void System::ReportUnsatisfied(Matrix *mat, List<hConstraint> *bad) {
+    for(int i = 0; i < mat->m; i++) {
+        if(ffabs(mat->B.num[i]) > CONVERGE_TOLERANCE || isnan(mat->B.num[i])) {
+            // This constraint is unsatisfied.
+            if(!mat->eq[i].isFromConstraint()) continue;
+
+            hConstraint hc = mat->eq[i].constraint();
+            ConstraintBase *c = SK.constraint.FindByIdNoOops(hc);
+            if(!c) continue;
+            // Don't double-show constraints that generated multiple
+            // unsatisfied equations
+            if(!c->tag) {
                 bad->Add(&(c->h));
+                c->tag = 1;
             }
         }
     }
 }
 
-SolveResult System::Solve(Group *g, int *dof, List<hConstraint> *bad,
-                          bool andFindBad, bool andFindFree, bool forceDofCheck)
-{
-    WriteEquationsExceptFor(Constraint::NO_CONSTRAINT, g);
+//-----------------------------------------------------------------------------
+// Write out everything that the structure of the system depends on: the
+// unknowns, the equations, and anything else that gets compiled in to them,
+// like the values of any params that are already known. That's kept with
+// the structure, and compared before it's reused; and a hash of it is the
+// key, to tell quickly when it's not the same.
+//-----------------------------------------------------------------------------
+static uint64_t BitsOf(double v) {
+    uint64_t x;
+    memcpy(&x, &v, sizeof(x));
+    return x;
+}
 
-    int i;
-    bool rankOk;
+void System::WriteStructureInputs(const Expr *e) {
+    structureInputs.push_back((uint64_t)e->op);
+    switch(e->op) {
+        case Expr::Op::PARAM: {
+            Param *p = param.FindByIdNoOops(e->parh);
+            if(!p) p = SK.GetParam(e->parh);
+            structureInputs.push_back(p->h.v);
+            structureInputs.push_back(p->known);
+            if(p->known) structureInputs.push_back(BitsOf(p->val));
+            return;
+        }
 
-/*
-    dbp("%d equations", eq.n);
-    for(i = 0; i < eq.n; i++) {
-        dbp("  %.3f = %s = 0", eq.elem[i].e->Eval(), eq.elem[i].e->Print());
+        case Expr::Op::CONSTANT:
+            structureInputs.push_back(BitsOf(e->v));
+            return;
+
+        default:
+            break;
     }
-    dbp("%d parameters", param.n);
-    for(i = 0; i < param.n; i++) {
-        dbp("   param %08x at %.3f", param.elem[i].h.v, param.elem[i].val);
-    } */
+    int c = e->Children();
+    if(c > 0) WriteStructureInputs(e->a);
+    if(c > 1) WriteStructureInputs(e->b);
+}
+
+uint64_t System::StructureKey(bool forceDofCheck) {
+    structureInputs.clear();
+    structureInputs.push_back(forceDofCheck);
+    structureInputs.push_back((uint64_t)param.n);
+    for(int i = 0; i < param.n; i++) {
+        Param *p = &(param.elem[i]);
+        structureInputs.push_back(p->h.v);
+        structureInputs.push_back(p->known);
+        if(p->known) structureInputs.push_back(BitsOf(p->val));
+    }
+    structureInputs.push_back((uint64_t)dragged.n);
+    for(hParam *hp = dragged.First(); hp; hp = dragged.NextAfter(hp)) {
+        structureInputs.push_back(hp->v);
+    }
+    structureInputs.push_back((uint64_t)eq.n);
+    for(int i = 0; i < eq.n; i++) {
+        Equation *e = &(eq.elem[i]);
+        structureInputs.push_back(e->h.v);
+        WriteStructureInputs(e->e);
+    }
+
+    uint64_t h = 0;
+    for(uint64_t x : structureInputs) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        h = (h ^ x) * 0x9e3779b97f4a7c15ULL;
+    }
+    // Zero means that there's nothing to reuse.
+    return (h == 0) ? 1 : h;
+}
+
+//-----------------------------------------------------------------------------
+// Make the structure of the given group the current one, and if it was
+// written for the same key, then bring it up to date and return true. The
+// structures of the other groups are kept, so that solving several groups
+// in turn doesn't throw them away.
+//-----------------------------------------------------------------------------
+bool System::FindStructure(hGroup hg, uint64_t key) {
+    if(hg.v != structureGroup.v) {
+        if(structure.key != 0) {
+            std::swap(structure.alone, alone);
+            std::swap(structure.subsys, subsys);
+            savedStructure[structureGroup.v] = std::move(structure);
+        }
+        structure = {};
+        auto it = savedStructure.find(hg.v);
+        if(it != savedStructure.end()) {
+            structure = std::move(it->second);
+            savedStructure.erase(it);
+            std::swap(structure.alone, alone);
+            std::swap(structure.subsys, subsys);
+        }
+        structureGroup = hg;
+    }
+    if(structure.key != key || structure.inputs != structureInputs) return false;
+    ssassert(structure.paramTag.size() == (size_t)param.n &&
+             structure.eqTag.size() == (size_t)eq.n, "Structure doesn't match system");
 
+    for(int i = 0; i < param.n; i++) {
+        Param *p = &(param.elem[i]);
+        p->tag    = structure.paramTag[i];
+        p->substd = structure.paramSubstd[i];
+    }
+    for(int i = 0; i < eq.n; i++) {
+        eq.elem[i].tag = structure.eqTag[i];
+    }
+    // The param tables have been written again since, so the compiled
+    // equations need to find their params again.
+    for(Subsystem &ss : alone) {
+        ss.mat.prog.ResolveParams(&param, &(SK.param));
+    }
+    for(Subsystem &ss : subsys) {
+        ss.mat.prog.ResolveParams(&param, &(SK.param));
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Work out the structure of the system from scratch: substitute, find the
+// equations that are soluble alone and the independent subsystems in what's
+// left, and write the Jacobians for all of those.
+//-----------------------------------------------------------------------------
+void System::WriteStructure(uint64_t key, bool forceDofCheck) {
     // All params and equations are assigned to group zero.
     param.ClearTags();
     eq.ClearTags();
@@ -425,11 +928,9 @@ SolveResult System::Solve(Group *g, int *dof, List<hConstraint> *bad,
     }
 
     // Before solving the big system, see if we can find any equations that
-    // are soluble alone. This can be a huge speedup. We don't know whether
-    // the system is consistent yet, but if it isn't then we'll catch that
-    // later.
-    int alone = 1;
-    for(i = 0; i < eq.n; i++) {
+    // are soluble alone. This can be a huge speedup.
+    alone.clear();
+    for(int i = 0; i < eq.n; i++) {
         Equation *e = &(eq.elem[i]);
         if(e->tag != 0) continue;
 
@@ -437,36 +938,166 @@ SolveResult System::Solve(Group *g, int *dof, List<hConstraint> *bad,
         if(hp.v == Expr::NO_PARAMS.v) continue;
         if(hp.v == Expr::MULTIPLE_PARAMS.v) continue;
 
-        Param *p = param.FindById(hp);
+        int j = param.IndexOf(hp);
+        Param *p = &(param.elem[j]);
         if(p->tag != 0) continue; // let rank test catch inconsistency
 
-        e->tag = alone;
-        p->tag = alone;
-        WriteJacobian(alone);
-        if(!NewtonSolve(alone)) {
-            // We don't do the rank test, so let's arbitrarily return
-            // the DIDNT_CONVERGE result here.
-            rankOk = true;
-            // Failed to converge, bail out early
-            goto didnt_converge;
+        alone.emplace_back();
+        Subsystem *ss = &alone.back();
+        ss->tag = (int)alone.size();
+        ss->eq.push_back(i);
+        ss->param.push_back(j);
+        e->tag = ss->tag;
+        p->tag = ss->tag;
+        WriteJacobian(ss->eq, ss->param, &ss->mat);
+    }
+
+    // What's left splits into independent subsystems; solve each of those
+    // separately, which is much cheaper than solving them all at once, and
+    // means that one that fails doesn't keep the others from solving.
+    FindSubsystems((int)alone.size() + 1);
+
+    // Writing the Jacobians allocates expressions, so that has to be done
+    // one subsystem at a time. Unknowns that aren't referenced by any
+    // equation are just free.
+    for(Subsystem &ss : subsys) {
+        if(ss.eq.empty()) continue;
+        WriteJacobian(ss.eq, ss.param, &ss.mat);
+    }
+
+    structure.key = key;
+    structure.inputs = structureInputs;
+    structure.paramTag.resize(param.n);
+    structure.paramSubstd.resize(param.n);
+    for(int i = 0; i < param.n; i++) {
+        structure.paramTag[i]    = param.elem[i].tag;
+        structure.paramSubstd[i] = param.elem[i].substd;
+    }
+    structure.eqTag.resize(eq.n);
+    for(int i = 0; i < eq.n; i++) {
+        structure.eqTag[i] = eq.elem[i].tag;
+    }
+}
+
+SolveResult System::Solve(Group *g, int *dof, List<hConstraint> *bad,
+                          bool andFindBad, bool andFindFree, bool forceDofCheck)
+{
+    WriteEquationsExceptFor(Constraint::NO_CONSTRAINT, g);
+
+    int i;
+    bool rankOk = true, converged = true;
+
+/*
+    dbp("%d equations", eq.n);
+    for(i = 0; i < eq.n; i++) {
+        dbp("  %.3f = %s = 0", eq.elem[i].e->Eval(), eq.elem[i].e->Print());
+    }
+    dbp("%d parameters", param.n);
+    for(i = 0; i < param.n; i++) {
+        dbp("   param %08x at %.3f", param.elem[i].h.v, param.elem[i].val);
+    } */
+
+    SK.constraint.ClearTags();
+
+    // The substitutions and the subsystems, with their compiled Jacobians,
+    // depend only on the equations; so if those are just what they were the
+    // last time that we solved this group, as when dragging, then reuse them.
+    uint64_t key = StructureKey(forceDofCheck);
+    if(!FindStructure(g->h, key)) {
+        WriteStructure(key, forceDofCheck);
+    }
+
+    // Any unknown that fails to converge keeps its old value; but the
+    // others are still good.
+    std::vector<bool> solved(param.n, true);
+
+    // Solve the equations that are soluble alone first. We don't know
+    // whether the system is consistent yet, but if it isn't then we'll catch
+    // that later.
+    for(Subsystem &ss : alone) {
+        // As below, while dragging, don't bother with any that can't have
+        // changed.
+        if(dragged.n > 0 && !IsAnyDragged(&ss) && IsSatisfied(&ss.mat)) {
+            continue;
+        }
+        if(!NewtonSolve(&ss.mat)) {
+            // We don't do the rank test, so let's arbitrarily count this
+            // as DIDNT_CONVERGE.
+            ReportUnsatisfied(&ss.mat, bad);
+            solved[ss.param[0]] = false;
+            converged = false;
         }
-        alone++;
     }
 
-    // Now write the Jacobian for what's left, and do a rank test; that
-    // tells us if the system is inconsistently constrained.
-    if(!WriteJacobian(0)) {
-        return SolveResult::TOO_MANY_UNKNOWNS;
+    // But after that, each subsystem only touches its own unknowns and its
+    // own matrix, so they can all be solved at once. Do a rank test too;
+    // that tells us if the subsystem is inconsistently constrained.
+    struct SubsystemResult {
+        bool rankOk;
+        bool converged;
+    };
+    std::vector<SubsystemResult> result(subsys.size(), { true, true });
+    ThreadPool::Get()->ParallelFor((int)subsys.size(), [&](int k) {
+        Subsystem *ss = &subsys[k];
+        if(ss->eq.empty()) return;
+
+        // While dragging, only the subsystems with a dragged unknown can
+        // change; any other that was solved last time, and is still
+        // satisfied, is left as it was, along with its rank. The free
+        // unknowns are found from the factorization that the rank test
+        // leaves, though, so if those are wanted then factor it again.
+        if(ss->solved && dragged.n > 0 && !IsAnyDragged(ss) &&
+           IsSatisfied(&ss->mat))
+        {
+            if(andFindFree) ss->rankOk = TestRank(&ss->mat);
+            result[k] = { ss->rankOk, true };
+            return;
+        }
+
+        bool ssRankOk = TestRank(&ss->mat);
+        if(!NewtonSolve(&ss->mat)) {
+            result[k] = { ssRankOk, false };
+        } else {
+            result[k] = { TestRank(&ss->mat), true };
+        }
+        ss->solved = result[k].converged;
+        ss->rankOk = result[k].rankOk;
+    });
+
+    // And gather up the results in order, so that the errors are reported
+    // the same way no matter which subsystem finished first.
+    for(size_t k = 0; k < subsys.size(); k++) {
+        Subsystem *ss = &subsys[k];
+        if(!result[k].converged) {
+            ReportUnsatisfied(&ss->mat, bad);
+            for(int j : ss->param) {
+                solved[j] = false;
+            }
+            converged = false;
+        }
+        if(!result[k].rankOk) rankOk = false;
     }
 
-    rankOk = TestRank();
+    // Write the new values back in to the main parameter table, for every
+    // subsystem that we solved.
+    for(i = 0; i < param.n; i++) {
+        Param *p = &(param.elem[i]);
+        Param *sp = p;
+        if(p->tag == VAR_SUBSTITUTED) {
+            sp = param.FindById(p->substd);
+        }
+        if(!solved[sp - param.elem]) continue;
+
+        Param *pp = SK.GetParam(p->h);
+        pp->val = sp->val;
+        pp->known = true;
+    }
 
-    // And do the leftovers as one big system
-    if(!NewtonSolve(0)) {
-        goto didnt_converge;
+    if(!converged) {
+        CountMemory();
+        return rankOk ? SolveResult::DIDNT_CONVERGE : SolveResult::REDUNDANT_DIDNT_CONVERGE;
     }
 
-    rankOk = TestRank();
     if(!rankOk) {
         if(!g->allowRedundant) {
             if(andFindBad) FindWhichToRemoveToFixJacobian(g, bad, forceDofCheck);
@@ -478,43 +1109,12 @@ SolveResult System::Solve(Group *g, int *dof, List<hConstraint> *bad,
         if(dof) *dof = CalculateDof();
         MarkParamsFree(andFindFree);
     }
-    // System solved correctly, so write the new values back in to the
-    // main parameter table.
     for(i = 0; i < param.n; i++) {
         Param *p = &(param.elem[i]);
-        double val;
-        if(p->tag == VAR_SUBSTITUTED) {
-            val = param.FindById(p->substd)->val;
-        } else {
-            val = p->val;
-        }
-        Param *pp = SK.GetParam(p->h);
-        pp->val = val;
-        pp->known = true;
-        pp->free = p->free;
+        SK.GetParam(p->h)->free = p->free;
     }
+    CountMemory();
     return rankOk ? SolveResult::OKAY : SolveResult::REDUNDANT_OKAY;
-
-didnt_converge:
-    SK.constraint.ClearTags();
-    for(i = 0; i < eq.n; i++) {
-        if(ffabs(mat.B.num[i]) > CONVERGE_TOLERANCE || isnan(mat.B.num[i])) {
-            // This constraint is unsatisfied.
-            if(!mat.eq[i].isFromConstraint()) continue;
-
-            hConstraint hc = mat.eq[i].constraint();
-            ConstraintBase *c = SK.constraint.FindByIdNoOops(hc);
-            if(!c) continue;
-            // Don't double-show constraints that generated multiple
-            // unsatisfied equations
-            if(!c->tag) {
-                bad->Add(&(c->h));
-                c->tag = 1;
-            }
-        }
-    }
-
-    return rankOk ? SolveResult::DIDNT_CONVERGE : SolveResult::REDUNDANT_DIDNT_CONVERGE;
 }
 
 SolveResult System::SolveRank(Group *g, int *dof, List<hConstraint> *bad,
@@ -530,13 +1130,25 @@ SolveResult System::SolveRank(Group *g, int *dof, List<hConstraint> *bad,
         SolveBySubstitution();
     }
 
-    // Now write the Jacobian, and do a rank test; that
-    // tells us if the system is inconsistently constrained.
-    if(!WriteJacobian(0)) {
-        return SolveResult::TOO_MANY_UNKNOWNS;
+    // Now write the Jacobian of each subsystem, and do a rank test; that
+    // tells us if the system is inconsistently constrained. As in Solve(),
+    // the Jacobians are written one by one, but tested concurrently. That
+    // replaces the subsystems of whatever group was solved last.
+    structure.key = 0;
+    alone.clear();
+    FindSubsystems(1);
+    for(Subsystem &ss : subsys) {
+        if(ss.eq.empty()) continue;
+        WriteJacobian(ss.eq, ss.param, &ss.mat);
     }
+    std::vector<char> ssRankOk(subsys.size(), true);
+    ThreadPool::Get()->ParallelFor((int)subsys.size(), [&](int k) {
+        Subsystem *ss = &subsys[k];
+        if(ss->eq.empty()) return;
+        ssRankOk[k] = TestRank(&ss->mat);
+    });
+    bool rankOk = std::find(ssRankOk.begin(), ssRankOk.end(), false) == ssRankOk.end();
 
-    bool rankOk = TestRank();
     if(!rankOk) {
         if(!g->allowRedundant) {
             if(andFindBad) FindWhichToRemoveToFixJacobian(g, bad, forceDofCheck);
@@ -548,6 +1160,7 @@ SolveResult System::SolveRank(Group *g, int *dof, List<hConstraint> *bad,
         if(dof) *dof = CalculateDof();
         MarkParamsFree(andFindFree);
     }
+    CountMemory();
     return rankOk ? SolveResult::OKAY : SolveResult::REDUNDANT_OKAY;
 }
 
@@ -556,6 +1169,78 @@ void System::Clear() {
     param.Clear();
     eq.Clear();
     dragged.Clear();
+    alone.clear();
+    subsys.clear();
+    structure = {};
+    savedStructure.clear();
+    structureInputs = {};
+    CountMemory();
+}
+
+//-----------------------------------------------------------------------------
+// Forget the structures kept for any group that's no longer in the sketch;
+// otherwise they'd stay until the next Clear(), since nothing else looks
+// them up again.
+//-----------------------------------------------------------------------------
+void System::ForgetDeletedGroups() {
+    for(auto it = savedStructure.begin(); it != savedStructure.end();) {
+        if(SK.group.FindByIdNoOops(hGroup { it->first }) == NULL) {
+            it = savedStructure.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if(structureGroup.v != 0 && SK.group.FindByIdNoOops(structureGroup) == NULL) {
+        alone.clear();
+        subsys.clear();
+        structure = {};
+        structureGroup = {};
+    }
+    CountMemory();
+}
+
+static size_t MemoryUsedBy(const std::vector<System::Subsystem> &subsystems) {
+    size_t bytes = CapacityBytes(subsystems);
+    for(const System::Subsystem &ss : subsystems) {
+        const System::Matrix *mat = &ss.mat;
+        bytes += CapacityBytes(ss.eq) + CapacityBytes(ss.param) +
+                 CapacityBytes(mat->eq) + CapacityBytes(mat->param) +
+                 CapacityBytes(mat->A.rowStart) + CapacityBytes(mat->A.col) +
+                 CapacityBytes(mat->A.reg) + CapacityBytes(mat->A.num) +
+                 CapacityBytes(mat->scale) + mat->AAt.MemoryUsed() +
+                 CapacityBytes(mat->Z) + CapacityBytes(mat->X) +
+                 CapacityBytes(mat->B.reg) + CapacityBytes(mat->B.num) +
+                 mat->prog.MemoryUsed() + CapacityBytes(mat->depStart) +
+                 CapacityBytes(mat->dep);
+    }
+    return bytes;
+}
+
+static size_t MemoryUsedBy(const System::Structure &st) {
+    return CapacityBytes(st.inputs) + CapacityBytes(st.paramTag) +
+           CapacityBytes(st.paramSubstd) + CapacityBytes(st.eqTag) +
+           MemoryUsedBy(st.alone) + MemoryUsedBy(st.subsys);
+}
+
+size_t System::MemoryUsed() const {
+    size_t bytes = MemoryUsedBy(subsys) + MemoryUsedBy(alone) + MemoryUsedBy(structure) +
+                   CapacityBytes(structureInputs);
+    for(const auto &it : savedStructure) {
+        bytes += sizeof(it) + MemoryUsedBy(it.second);
+    }
+    return bytes;
+}
+
+void System::CountMemory() {
+    // Count the difference from last time, so that whatever was counted
+    // is uncounted again once it's gone (or counting is disabled).
+    size_t bytes = MemoryUsage::IsEnabled() ? MemoryUsed() : 0;
+    if(bytes > memoryCounted) {
+        MemoryUsage::Count(MemoryTag::SOLVER, bytes - memoryCounted, /*allocated=*/true);
+    } else {
+        MemoryUsage::Count(MemoryTag::SOLVER, memoryCounted - bytes, /*allocated=*/false);
+    }
+    memoryCounted = bytes;
 }
 
 void System::MarkParamsFree(bool find) {
@@ -563,25 +1248,66 @@ void System::MarkParamsFree(bool find) {
     // more than the number of degrees of freedom. Don't always do this,
     // because the display would get annoying and it's slow.
     for(int i = 0; i < param.n; i++) {
-        Param *p = &(param.elem[i]);
-        p->free = false;
-
-        if(find) {
-            if(p->tag == 0) {
-                p->tag = VAR_DOF_TEST;
-                WriteJacobian(0);
-                EvalJacobian();
-                int rank = CalculateRank();
-                if(rank == mat.m) {
-                    p->free = true;
-                }
-                p->tag = 0;
+        param.elem[i].free = false;
+    }
+    if(!find) return;
+
+    // A variable is free if its subsystem is still full rank without it;
+    // the other subsystems don't care. Removing the column a for that
+    // variable from A leaves A*A' - a*a', which is singular exactly when
+    // a'*inverse(A*A')*a is one; and that's the squared length of the
+    // projection of the unit vector along that variable on to the rows
+    // of A. So one minus that is the squared distance from the variable to
+    // the rows, just like what the rank test looks at, and we can find it
+    // from the factorization that the rank test already did.
+    std::vector<int> colStart, colRow;
+    std::vector<double> colVal;
+    std::vector<int> aRow;
+    std::vector<double> aVal;
+    for(Subsystem &ss : subsys) {
+        Matrix *mat = &ss.mat;
+        if(ss.eq.empty()) {
+            // Nothing constrains these at all.
+            for(int i : ss.param) {
+                param.elem[i].free = true;
+            }
+            continue;
+        }
+
+        // We need the columns of A, so transpose it.
+        colStart.assign(mat->n + 1, 0);
+        for(int j : mat->A.col) {
+            colStart[j + 1]++;
+        }
+        for(int j = 0; j < mat->n; j++) {
+            colStart[j + 1] += colStart[j];
+        }
+        colRow.resize(mat->A.col.size());
+        colVal.resize(mat->A.col.size());
+        std::vector<int> colNext(colStart.begin(), colStart.end() - 1);
+        for(int r = 0; r < mat->m; r++) {
+            for(int p = mat->A.rowStart[r]; p < mat->A.rowStart[r+1]; p++) {
+                int q = colNext[mat->A.col[p]]++;
+                colRow[q] = r;
+                colVal[q] = mat->A.num[p];
+            }
+        }
+
+        for(int j = 0; j < mat->n; j++) {
+            aRow.assign(colRow.begin() + colStart[j], colRow.begin() + colStart[j+1]);
+            aVal.assign(colVal.begin() + colStart[j], colVal.begin() + colStart[j+1]);
+            double proj = mat->AAt.InverseQuadraticForm(aRow, aVal);
+            if(1 - proj > RANK_MAG_TOLERANCE*RANK_MAG_TOLERANCE) {
+                param.elem[ss.param[j]].free = true;
             }
         }
     }
 }
 
 int System::CalculateDof() {
-    return mat.n - mat.m;
+    int dof = 0;
+    for(Subsystem &ss : subsys) {
+        dof += (int)ss.param.size() - (int)ss.eq.size();
+    }
+    return dof;
 }
-
@@ -0,0 +1,198 @@
+//-----------------------------------------------------------------------------
+// A work-stealing pool of worker threads.
+//-----------------------------------------------------------------------------
+#include "solvespace.h"
+#if defined(WIN32)
+// Include Microsoft headers after solvespace.h to avoid clashes.
+#   include <windows.h>
+#else
+#   include <pthread.h>
+#   include <unistd.h>
+#   include <sys/resource.h>
+#endif
+
+// The pool that this thread is a worker of, if any, and which worker.
+static thread_local ThreadPool *currentPool   = NULL;
+static thread_local int         currentWorker = -1;
+
+//-----------------------------------------------------------------------------
+// Deeply recursive code, like inserting into a BSP, runs on the workers; so
+// they're started with a stack at least as big as the main thread's, and not
+// with the platform's default for other threads, which can be much smaller
+// (512 KiB on macOS, against 8 MiB for the main thread).
+//-----------------------------------------------------------------------------
+static const size_t MIN_STACK_SIZE = 8 * 1024 * 1024;
+
+struct ThreadPool::Worker {
+    ThreadPool *pool;
+    int         self;
+#if defined(WIN32)
+    HANDLE      thread;
+
+    static DWORD WINAPI Run(LPVOID arg) {
+        Worker *w = (Worker *)arg;
+        w->pool->Work(w->self);
+        return 0;
+    }
+
+    void Start() {
+        thread = CreateThread(NULL, MIN_STACK_SIZE, Run, this,
+                              STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+        ssassert(thread != NULL, "Cannot create worker thread");
+    }
+
+    void Join() {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+#else
+    pthread_t   thread;
+
+    static void *Run(void *arg) {
+        Worker *w = (Worker *)arg;
+        w->pool->Work(w->self);
+        return NULL;
+    }
+
+    static size_t StackSize() {
+        size_t size = MIN_STACK_SIZE;
+        struct rlimit limit;
+        if(getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+            size = std::max(size, (size_t)limit.rlim_cur);
+        }
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        return (size + page - 1) / page * page;
+    }
+
+    void Start() {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, StackSize());
+        int err = pthread_create(&thread, &attr, Run, this);
+        pthread_attr_destroy(&attr);
+        ssassert(err == 0, "Cannot create worker thread");
+    }
+
+    void Join() {
+        pthread_join(thread, NULL);
+    }
+#endif
+};
+
+ThreadPool *ThreadPool::Get() {
+    // The thread that calls ParallelFor runs tasks too, so it counts as one.
+    static ThreadPool pool((int)std::thread::hardware_concurrency() - 1);
+    return &pool;
+}
+
+ThreadPool::ThreadPool(int workerCount) : queued(0), exiting(false) {
+    workerCount = std::max(workerCount, 0);
+    for(int i = 0; i < workerCount + 1; i++) {
+        queues.emplace_back(new Queue);
+    }
+    for(int i = 0; i < workerCount; i++) {
+        workers.emplace_back(new Worker { this, i, {} });
+        workers.back()->Start();
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        exiting = true;
+    }
+    idle.notify_all();
+    for(std::unique_ptr<Worker> &w : workers) {
+        w->Join();
+    }
+}
+
+int ThreadPool::QueueIndex() const {
+    if(currentPool == this) return currentWorker;
+    return (int)queues.size() - 1;
+}
+
+bool ThreadPool::RunOne(int self) {
+    Task task;
+    bool found = false;
+    // Our own newest task first, since its data is most likely to still be
+    // in cache; otherwise the oldest task of anyone else.
+    {
+        Queue *q = queues[self].get();
+        std::lock_guard<std::mutex> lock(q->mutex);
+        if(!q->tasks.empty()) {
+            task = q->tasks.back();
+            q->tasks.pop_back();
+            found = true;
+        }
+    }
+    for(size_t i = 1; !found && i < queues.size(); i++) {
+        Queue *q = queues[(self + i) % queues.size()].get();
+        std::lock_guard<std::mutex> lock(q->mutex);
+        if(!q->tasks.empty()) {
+            task = q->tasks.front();
+            q->tasks.pop_front();
+            found = true;
+        }
+    }
+    if(!found) return false;
+    queued--;
+
+    Batch *batch = task.batch;
+    (*batch->fn)(task.index);
+
+    // The batch lives on the stack of the thread that's waiting for it, so
+    // don't touch it after it's released.
+    std::lock_guard<std::mutex> lock(batch->mutex);
+    if(--batch->remaining == 0) {
+        batch->done.notify_all();
+    }
+    return true;
+}
+
+void ThreadPool::Work(int self) {
+    currentPool   = this;
+    currentWorker = self;
+    for(;;) {
+        if(RunOne(self)) continue;
+
+        std::unique_lock<std::mutex> lock(idleMutex);
+        idle.wait(lock, [&] { return exiting || queued > 0; });
+        if(exiting) return;
+    }
+}
+
+void ThreadPool::ParallelFor(int n, const std::function<void(int)> &fn) {
+    if(workers.empty() || n <= 1) {
+        for(int i = 0; i < n; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    Batch batch;
+    batch.fn        = &fn;
+    batch.remaining = n;
+
+    // Everything goes on our own queue; the idle threads will steal it.
+    int self = QueueIndex();
+    {
+        Queue *q = queues[self].get();
+        std::lock_guard<std::mutex> lock(q->mutex);
+        for(int i = 0; i < n; i++) {
+            q->tasks.push_back({ &batch, i });
+        }
+    }
+    queued += n;
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        idle.notify_all();
+    }
+
+    // Help out until there's nothing left to take; by then, all of our tasks
+    // have been started, so just wait for the rest to finish.
+    while(RunOne(self)) {}
+
+    std::unique_lock<std::mutex> lock(batch.mutex);
+    batch.done.wait(lock, [&] { return batch.remaining == 0; });
+}
@@ -0,0 +1,58 @@
+//-----------------------------------------------------------------------------
+// A pool of worker threads, for running independent pieces of work (like
+// the independent subsystems of a sketch) concurrently.
+//-----------------------------------------------------------------------------
+#ifndef __THREADPOOL_H
+#define __THREADPOOL_H
+
+// Each thread has its own queue of tasks, and takes from the end of that
+// queue; once it's empty, it steals from the front of the others. A thread
+// that's waiting for its own tasks to finish runs tasks while it waits, so
+// it's fine to call ParallelFor from inside a task.
+class ThreadPool {
+public:
+    // The pool that everything shares, with a thread for each core.
+    static ThreadPool *Get();
+
+    ThreadPool(int workerCount);
+    ~ThreadPool();
+
+    int ThreadCount() const { return (int)workers.size() + 1; }
+
+    // Call fn(i) for each i from 0 to n-1, in no particular order and on
+    // any thread (including this one), and return once all of them have.
+    void ParallelFor(int n, const std::function<void(int)> &fn);
+
+private:
+    struct Batch {
+        const std::function<void(int)> *fn;
+        int                      remaining;
+        std::mutex               mutex;
+        std::condition_variable  done;
+    };
+    struct Task {
+        Batch   *batch;
+        int      index;
+    };
+    struct Queue {
+        std::mutex          mutex;
+        std::deque<Task>    tasks;
+    };
+
+    struct Worker;
+
+    // One queue for each worker, plus one at the end for all other threads.
+    std::vector<std::unique_ptr<Queue>>  queues;
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::mutex                  idleMutex;
+    std::condition_variable     idle;
+    std::atomic<int>            queued;
+    bool                        exiting;
+
+    int QueueIndex() const;
+    bool RunOne(int self);
+    void Work(int self);
+};
+
+#endif
@@ -36,6 +36,7 @@ void SolveSpaceUI::UndoEnableMenus() {
 }
 
 void SolveSpaceUI::PushFromCurrentOnto(UndoStack *uk) {
+    MemoryTagScope tag(MemoryTag::UNDO);
     int i;
 
     if(uk->cnt == MAX_UNDO) {
@@ -90,6 +90,212 @@ void SolveSpace::MultMatrix(double *mata, double *matb, double *matr) {
     }
 }
 
+//-----------------------------------------------------------------------------
+// A separate heap, on which we allocate expressions, BSP nodes, and other
+// stuff that can all be freed at once at the end, to save us the trouble of
+// freeing it explicitly. It's an arena: memory comes from big chunks, so
+// allocating just bumps a pointer, and freeing everything frees the chunks.
+// Each thread has its own, so nothing here needs to be locked.
+//-----------------------------------------------------------------------------
+struct TempChunk {
+    TempChunk   *prev;
+    size_t       size;
+    size_t       used;
+    bool         counted;
+};
+
+static const size_t TEMP_ALIGN      = 16;
+static const size_t TEMP_HEADER     = (sizeof(TempChunk) + TEMP_ALIGN - 1) & ~(TEMP_ALIGN - 1);
+static const size_t TEMP_CHUNK_SIZE = 1024*1024 - TEMP_HEADER;
+
+static char *TempChunkData(TempChunk *c) {
+    return (char *)c + TEMP_HEADER;
+}
+
+struct TempHeap {
+    // The chunk that we're allocating from, and the previous ones before it.
+    TempChunk   *top  = NULL;
+    // The last thing allocated, which FreeTemporary() can give back.
+    void        *last = NULL;
+
+    void FreeChunksTo(TempChunk *chunk) {
+        while(top != chunk) {
+            TempChunk *c = top;
+            top = c->prev;
+            if(c->counted) {
+                MemoryUsage::Count(MemoryTag::TEMPORARY, TEMP_HEADER + c->size,
+                                   /*allocated=*/false);
+            }
+            free(c);
+        }
+    }
+
+    ~TempHeap() {
+        FreeChunksTo(NULL);
+    }
+};
+
+static thread_local TempHeap Temp;
+
+void *SolveSpace::AllocTemporary(size_t n) {
+    size_t size = (n + TEMP_ALIGN - 1) & ~(TEMP_ALIGN - 1);
+    if(Temp.top == NULL || Temp.top->used + size > Temp.top->size) {
+        // Not MemAlloc(), since the chunks are counted as temporary memory
+        // whatever they're used for.
+        TempChunk *c = (TempChunk *)malloc(TEMP_HEADER + max(TEMP_CHUNK_SIZE, size));
+        ssassert(c != NULL, "Cannot allocate memory");
+        c->prev = Temp.top;
+        c->size = max(TEMP_CHUNK_SIZE, size);
+        c->used = 0;
+        c->counted = MemoryUsage::IsEnabled();
+        if(c->counted) {
+            MemoryUsage::Count(MemoryTag::TEMPORARY, TEMP_HEADER + c->size,
+                               /*allocated=*/true);
+        }
+        Temp.top = c;
+    }
+    void *p = TempChunkData(Temp.top) + Temp.top->used;
+    Temp.top->used += size;
+    memset(p, 0, n);
+    Temp.last = p;
+    return p;
+}
+
+void SolveSpace::FreeTemporary(void *p) {
+    // Only the last allocation can actually be given back; anything else
+    // stays until the heap is freed.
+    if(p != Temp.last) return;
+    Temp.top->used = (size_t)((char *)p - TempChunkData(Temp.top));
+    Temp.last = NULL;
+}
+
+TempMark SolveSpace::MarkTemporary() {
+    return { Temp.top, Temp.top ? Temp.top->used : 0 };
+}
+
+void SolveSpace::FreeTemporaryTo(TempMark mark) {
+    Temp.FreeChunksTo((TempChunk *)mark.chunk);
+    if(Temp.top) Temp.top->used = mark.used;
+    Temp.last = NULL;
+    // The shared expressions might have been among what was freed.
+    Expr::FreeAllShared();
+}
+
+void SolveSpace::FreeAllTemporary() {
+    // Keep the first chunk, so that we don't have to get it again at once.
+    TempChunk *first = Temp.top;
+    while(first && first->prev) first = first->prev;
+    if(first && first->size != TEMP_CHUNK_SIZE) first = NULL;
+    Temp.FreeChunksTo(first);
+    if(Temp.top) Temp.top->used = 0;
+    Temp.last = NULL;
+    Expr::FreeAllShared();
+}
+
+//-----------------------------------------------------------------------------
+// Counting the memory in use, by what it's used for. Each block from
+// MemAlloc() has a header that says how it was counted, so that it can be
+// uncounted in the same way when it's freed.
+//-----------------------------------------------------------------------------
+struct MemoryHeader {
+    size_t      size;
+    uint32_t    tag;
+};
+static_assert(sizeof(MemoryHeader) <= MemoryUsage::HEADER, "Memory header too big");
+
+static const uint32_t UNCOUNTED = 0xffffffff;
+
+static std::atomic<bool>    MemoryEnabled(false);
+static std::atomic<size_t>  MemoryCurrent[MemoryUsage::TAGS];
+static std::atomic<size_t>  MemoryPeak[MemoryUsage::TAGS];
+static thread_local MemoryTag CurrentMemoryTag = MemoryTag::OTHER;
+
+void MemoryUsage::Enable(bool enable) {
+    MemoryEnabled = enable;
+}
+
+bool MemoryUsage::IsEnabled() {
+    return MemoryEnabled.load(std::memory_order_relaxed);
+}
+
+size_t MemoryUsage::Current(MemoryTag tag) {
+    return MemoryCurrent[(int)tag];
+}
+
+size_t MemoryUsage::Peak(MemoryTag tag) {
+    return MemoryPeak[(int)tag];
+}
+
+void MemoryUsage::ResetPeaks() {
+    for(int i = 0; i < TAGS; i++) {
+        MemoryPeak[i] = MemoryCurrent[i].load();
+    }
+}
+
+const char *MemoryUsage::TagName(MemoryTag tag) {
+    switch(tag) {
+        case MemoryTag::OTHER:      return "other";
+        case MemoryTag::SOLVER:     return "solver";
+        case MemoryTag::SHELL:      return "shell";
+        case MemoryTag::MESH:       return "mesh";
+        case MemoryTag::RENDER:     return "render";
+        case MemoryTag::UNDO:       return "undo";
+        case MemoryTag::BSP:        return "bsp";
+        case MemoryTag::TEMPORARY:  return "temporary";
+    }
+    ssassert(false, "Unexpected memory tag");
+}
+
+std::string MemoryUsage::FormatBytes(size_t bytes) {
+    if(bytes >= 1024*1024) {
+        return ssprintf("%.1f MiB", (double)bytes / (1024*1024));
+    } else if(bytes >= 1024) {
+        return ssprintf("%.1f KiB", (double)bytes / 1024);
+    } else {
+        return ssprintf("%d B", (int)bytes);
+    }
+}
+
+void MemoryUsage::Count(MemoryTag tag, size_t bytes, bool allocated) {
+    int i = (int)tag;
+    if(allocated) {
+        size_t now  = (MemoryCurrent[i] += bytes);
+        size_t peak = MemoryPeak[i].load(std::memory_order_relaxed);
+        while(now > peak && !MemoryPeak[i].compare_exchange_weak(peak, now)) {}
+    } else {
+        MemoryCurrent[i] -= bytes;
+    }
+}
+
+void *MemoryUsage::Allocated(void *block, size_t n) {
+    MemoryHeader *h = (MemoryHeader *)block;
+    h->size = n;
+    if(IsEnabled()) {
+        h->tag = (uint32_t)CurrentMemoryTag;
+        Count(CurrentMemoryTag, n, /*allocated=*/true);
+    } else {
+        h->tag = UNCOUNTED;
+    }
+    return (char *)block + HEADER;
+}
+
+void *MemoryUsage::Freed(void *p) {
+    if(p == NULL) return NULL;
+    MemoryHeader *h = (MemoryHeader *)((char *)p - HEADER);
+    if(h->tag != UNCOUNTED) {
+        Count((MemoryTag)h->tag, h->size, /*allocated=*/false);
+    }
+    return h;
+}
+
+MemoryTagScope::MemoryTagScope(MemoryTag tag) : prev(CurrentMemoryTag) {
+    CurrentMemoryTag = tag;
+}
+
+MemoryTagScope::~MemoryTagScope() {
+    CurrentMemoryTag = prev;
+}
+
 //-----------------------------------------------------------------------------
 // Word-wrap the string for our message box appropriately, and then display
 // that string.
@@ -216,6 +422,190 @@ void BandedMatrix::Solve() {
     }
 }
 
+//-----------------------------------------------------------------------------
+// Find the structure of L, given the structure of the matrix: the elimination
+// tree, and the number of nonzeros in each column of L. This depends only on
+// the sparsity pattern, so it can be done once, and then reused for any
+// number of numeric factorizations.
+//-----------------------------------------------------------------------------
+void SparseSymmetricMatrix::Analyze() {
+    std::vector<int> flag(n);
+    parent.assign(n, -1);
+    lCount.assign(n, 0);
+    for(int k = 0; k < n; k++) {
+        flag[k] = k;
+        for(int p = rowStart[k]; p < rowStart[k+1]; p++) {
+            // Walk up the tree from each nonzero, marking the nodes that
+            // will get fill in row k of L.
+            for(int i = col[p]; flag[i] != k; i = parent[i]) {
+                if(parent[i] == -1) parent[i] = k;
+                lCount[i]++;
+                flag[i] = k;
+            }
+        }
+    }
+    lStart.resize(n + 1);
+    lStart[0] = 0;
+    for(int k = 0; k < n; k++) {
+        lStart[k+1] = lStart[k] + lCount[k];
+    }
+    lRow.resize(lStart[n]);
+    lVal.resize(lStart[n]);
+    d.resize(n);
+}
+
+//-----------------------------------------------------------------------------
+// Factor the matrix, one row of L at a time. Pivots no greater than pivotTol
+// (or not a number) are dropped; for a Gram matrix A*A', row k's pivot is the
+// magnitude squared of what's left of row k of A after removing its
+// components along all the previous rows, so this is equivalent to
+// Gram-Schmidt on the rows of A.
+//-----------------------------------------------------------------------------
+void SparseSymmetricMatrix::Factor(double pivotTol) {
+    std::vector<double> y(n, 0.0);
+    std::vector<int> pattern(n), flag(n);
+    zeroPivots = 0;
+    for(int k = 0; k < n; k++) {
+        // Scatter row k into y, and find the nonzero pattern of row k of L
+        // in topological order.
+        int top = n;
+        flag[k] = k;
+        lCount[k] = 0;
+        for(int p = rowStart[k]; p < rowStart[k+1]; p++) {
+            int i = col[p], len = 0;
+            y[i] += val[p];
+            for(; flag[i] != k; i = parent[i]) {
+                pattern[len++] = i;
+                flag[i] = k;
+            }
+            while(len > 0) pattern[--top] = pattern[--len];
+        }
+
+        // Now solve for row k of L by sparse triangular solve. A column with
+        // a dropped pivot is all zeros, so it's skipped; that also keeps a
+        // row that's not a number from spreading to the rows after it.
+        d[k] = y[k];
+        y[k] = 0;
+        int first = top;
+        for(; top < n; top++) {
+            int i = pattern[top];
+            double yi = y[i];
+            y[i] = 0;
+            int p, pend = lStart[i] + lCount[i];
+            double lki = 0;
+            if(d[i] != 0) {
+                for(p = lStart[i]; p < pend; p++) {
+                    y[lRow[p]] -= lVal[p]*yi;
+                }
+                lki = yi/d[i];
+                d[k] -= lki*yi;
+            }
+            lRow[pend] = k;
+            lVal[pend] = lki;
+            lCount[i]++;
+        }
+
+        if(!(d[k] > pivotTol)) {
+            if(isnan(d[k])) {
+                // Nothing in this row means anything, so treat it as all
+                // zeros; then its null vector is just itself.
+                for(top = first; top < n; top++) {
+                    int i = pattern[top];
+                    lVal[lStart[i] + lCount[i] - 1] = 0;
+                }
+            }
+            d[k] = 0;
+            zeroPivots++;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Solve L*D*L' x = b, with b passed in x and overwritten by the solution. Any
+// unknown with a dropped pivot is just set to zero.
+//-----------------------------------------------------------------------------
+void SparseSymmetricMatrix::Solve(double *x) const {
+    int i, p;
+    for(i = 0; i < n; i++) {
+        for(p = lStart[i]; p < lStart[i] + lCount[i]; p++) {
+            x[lRow[p]] -= lVal[p]*x[i];
+        }
+    }
+    for(i = 0; i < n; i++) {
+        x[i] = (d[i] == 0) ? 0 : x[i]/d[i];
+    }
+    for(i = n - 1; i >= 0; i--) {
+        for(p = lStart[i]; p < lStart[i] + lCount[i]; p++) {
+            x[i] -= lVal[p]*x[lRow[p]];
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Find a vector y in the null space of the factored matrix, given one of its
+// dropped pivots i. That's the solution of L'*y = e_i, since then L*D*L'*y
+// = L*D*e_i = 0; and y is zero past i, since L' is upper triangular.
+//-----------------------------------------------------------------------------
+void SparseSymmetricMatrix::NullVector(int i, double *y) const {
+    ssassert(d[i] == 0, "Expected a dropped pivot");
+    for(int j = 0; j < n; j++) {
+        y[j] = 0;
+    }
+    y[i] = 1;
+    for(int j = i - 1; j >= 0; j--) {
+        for(int p = lStart[j]; p < lStart[j] + lCount[j]; p++) {
+            y[j] -= lVal[p]*y[lRow[p]];
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Find x'*inverse(L*D*L')*x, for a sparse x with values xVal in rows xRow.
+// That's y'*inverse(D)*y for y = inverse(L)*x, so we need only the forward
+// solve; and y is nonzero only where x is, and at their ancestors in the
+// elimination tree, so only that part of L gets used. Unknowns with a
+// dropped pivot are ignored, as in Solve().
+//-----------------------------------------------------------------------------
+double SparseSymmetricMatrix::InverseQuadraticForm(const std::vector<int> &xRow,
+                                                   const std::vector<double> &xVal) {
+    if(work.size() != (size_t)n) {
+        work.assign(n, 0.0);
+        visited.assign(n, 0);
+    }
+
+    // Find the rows that y can be nonzero in.
+    reach.clear();
+    for(size_t k = 0; k < xRow.size(); k++) {
+        for(int i = xRow[k]; i != -1 && !visited[i]; i = parent[i]) {
+            visited[i] = 1;
+            reach.push_back(i);
+        }
+        work[xRow[k]] += xVal[k];
+    }
+    // Increasing order is a topological order for L, since L(i,j) is nonzero
+    // only for i > j.
+    std::sort(reach.begin(), reach.end());
+
+    double sum = 0;
+    for(int i : reach) {
+        double yi = work[i];
+        work[i] = 0;
+        for(int p = lStart[i]; p < lStart[i] + lCount[i]; p++) {
+            work[lRow[p]] -= lVal[p]*yi;
+        }
+        if(d[i] != 0) sum += yi*yi/d[i];
+        visited[i] = 0;
+    }
+    return sum;
+}
+
+size_t SparseSymmetricMatrix::MemoryUsed() const {
+    return CapacityBytes(rowStart) + CapacityBytes(col) + CapacityBytes(val) +
+           CapacityBytes(parent) + CapacityBytes(lStart) + CapacityBytes(lCount) +
+           CapacityBytes(lRow) + CapacityBytes(lVal) + CapacityBytes(d) +
+           CapacityBytes(work) + CapacityBytes(reach) + CapacityBytes(visited);
+}
+
 const Quaternion Quaternion::IDENTITY = { 1, 0, 0, 0 };
 
 Quaternion Quaternion::From(double w, double vx, double vy, double vz) {
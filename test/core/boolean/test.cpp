@@ -0,0 +1,265 @@
+#include "harness.h"
+
+// A closed loop of Beziers in the XY plane, running clockwise as seen from
+// above, as Group::AssembleLoops would leave it for an extrusion upwards.
+static SBezierLoopSet LoopFrom(const std::vector<SBezier> &curves) {
+    SBezierLoop sbl = {};
+    for(SBezier sb : curves) {
+        sbl.l.Add(&sb);
+    }
+    SBezierLoopSet sbls = {};
+    sbls.l.Add(&sbl);
+    sbls.normal = Vector::From(0, 0, 1);
+    sbls.point  = curves[0].Start();
+    return sbls;
+}
+
+static SBezierLoopSet Square(double x0, double y0, double x1, double y1) {
+    Vector a = Vector::From(x0, y0, 0), b = Vector::From(x1, y0, 0),
+           c = Vector::From(x1, y1, 0), d = Vector::From(x0, y1, 0);
+    return LoopFrom({ SBezier::From(a, d), SBezier::From(d, c),
+                      SBezier::From(c, b), SBezier::From(b, a) });
+}
+
+static SBezierLoopSet Circle(double x, double y, double r) {
+    std::vector<SBezier> arcs;
+    for(int i = 4; i > 0; i--) {
+        double t0 = i*PI/2, t1 = (i - 1)*PI/2;
+        Vector p0 = Vector::From(x + r*cos(t0), y + r*sin(t0), 0),
+               p1 = Vector::From(x + r*(cos(t0) + sin(t0)), y + r*(sin(t0) - cos(t0)), 0),
+               p2 = Vector::From(x + r*cos(t1), y + r*sin(t1), 0);
+        SBezier sb = SBezier::From(p0, p1, p2);
+        sb.weight[1] = sqrt(2)/2;
+        arcs.push_back(sb);
+    }
+    return LoopFrom(arcs);
+}
+
+// A plate with a grid of pockets through it, square and round by turns,
+// each cut by its own Boolean; so there's some of every kind of curve.
+static void MakePlate(SShell *plate, int n) {
+    RgbaColor color = RgbaColor::From(100, 100, 100);
+    SBezierLoopSet outline = Square(0, 0, 10*n, 10*n);
+    plate->MakeFromExtrusionOf(&outline, Vector::From(0, 0, 0), Vector::From(0, 0, 5), color);
+    outline.Clear();
+    for(int i = 0; i < n; i++) {
+        for(int j = 0; j < n; j++) {
+            SBezierLoopSet pocket = ((i + j) % 2 == 0)
+                ? Square(10*i + 2, 10*j + 2, 10*i + 8, 10*j + 8)
+                : Circle(10*i + 5, 10*j + 5, 3);
+            SShell tool = {}, result = {};
+            tool.MakeFromExtrusionOf(&pocket, Vector::From(0, 0, -1), Vector::From(0, 0, 6), color);
+            result.MakeFromDifferenceOf(plate, &tool);
+            plate->Clear();
+            tool.Clear();
+            pocket.Clear();
+            *plate = result;
+        }
+    }
+}
+
+static bool SameShell(SShell *a, SShell *b) {
+    if(a->surface.n != b->surface.n || a->curve.n != b->curve.n) return false;
+    for(int i = 0; i < a->curve.n; i++) {
+        SCurve *ca = &a->curve.elem[i], *cb = &b->curve.elem[i];
+        if(ca->h.v != cb->h.v || ca->surfA.v != cb->surfA.v ||
+           ca->surfB.v != cb->surfB.v || ca->pts.n != cb->pts.n) return false;
+        for(int j = 0; j < ca->pts.n; j++) {
+            if(!ca->pts.elem[j].p.Equals(cb->pts.elem[j].p)) return false;
+        }
+    }
+    for(int i = 0; i < a->surface.n; i++) {
+        SSurface *sa = &a->surface.elem[i], *sb = &b->surface.elem[i];
+        if(sa->h.v != sb->h.v || sa->trim.n != sb->trim.n) return false;
+        for(int j = 0; j < sa->trim.n; j++) {
+            STrimBy *ta = &sa->trim.elem[j], *tb = &sb->trim.elem[j];
+            if(ta->curve.v != tb->curve.v || ta->backwards != tb->backwards ||
+               !ta->start.Equals(tb->start) || !ta->finish.Equals(tb->finish)) return false;
+        }
+    }
+    return true;
+}
+
+TEST_CASE(difference_repeatable) {
+    // The surfaces are intersected and trimmed on many threads at once, but
+    // the result mustn't depend on which finished first; so the same
+    // Booleans, done again, give the same surfaces and curves, with the
+    // same handles, as the first time.
+    SS.chordTolCalculated = 0.02;
+    SS.maxSegments = 10;
+    SShell first = {};
+    MakePlate(&first, 4);
+    CHECK_FALSE(first.booleanFailed);
+    CHECK_TRUE(first.surface.n == 102);
+    CHECK_TRUE(first.curve.n == 332);
+    for(int run = 0; run < 4; run++) {
+        SShell again = {};
+        MakePlate(&again, 4);
+        bool same = SameShell(&first, &again);
+        again.Clear();
+        CHECK_TRUE(same);
+    }
+    first.Clear();
+}
+
+TEST_CASE(classifying_bsp_cache) {
+    // A block, and the same block turned half way around the z axis, so that
+    // the x and y of every point on it just change sign; those are different
+    // surfaces, and mustn't share a classifying BSP. But a copy of the block
+    // finds the BSPs that were built for it.
+    SBezierLoopSet square = Square(1, 1, 2, 2);
+    SShell block = {}, turned = {}, copy = {};
+    block.MakeFromExtrusionOf(&square, Vector::From(0, 0, 0), Vector::From(0, 0, 1),
+                              RgbaColor::From(100, 100, 100));
+    square.Clear();
+    turned.MakeFromTransformationOf(&block, Vector::From(0, 0, 0),
+                                    Quaternion::From(0, 0, 0, 1), 1.0);
+    copy.MakeFromCopyOf(&block);
+    block.MakeClassifyingBsps(NULL);
+    turned.MakeClassifyingBsps(NULL);
+    copy.MakeClassifyingBsps(NULL);
+
+    CHECK_TRUE(block.surface.n == 6 && turned.surface.n == 6 && copy.surface.n == 6);
+    bool shared = false, reused = true;
+    for(int i = 0; i < 6; i++) {
+        for(int j = 0; j < 6; j++) {
+            if(turned.surface.elem[i].bsp == block.surface.elem[j].bsp) shared = true;
+        }
+        if(copy.surface.elem[i].bsp != block.surface.elem[i].bsp) reused = false;
+    }
+    CHECK_FALSE(shared);
+    CHECK_TRUE(reused);
+
+    // And the top of the turned block has its middle inside.
+    for(int i = 0; i < 6; i++) {
+        SSurface *srf = &turned.surface.elem[i];
+        if(srf->degm != 1 || srf->degn != 1 || srf->ctrl[0][0].z != 1 ||
+           srf->ctrl[1][1].z != 1) continue;
+        Point2d puv, dummy = {};
+        srf->ClosestPointTo(Vector::From(-1.5, -1.5, 1), &puv);
+        CHECK_TRUE(srf->bsp->ClassifyPoint(puv, dummy, srf) == SBspUv::Class::INSIDE);
+    }
+
+    block.CleanupAfterBoolean();
+    turned.CleanupAfterBoolean();
+    copy.CleanupAfterBoolean();
+    block.Clear();
+    turned.Clear();
+    copy.Clear();
+    // Forget them all; the first time only marks them unused.
+    SBspUv::ForgetUnused();
+    SBspUv::ForgetUnused();
+}
+
+TEST_CASE(split_curves_in_parallel) {
+    // A row of cubes astride the x axis, and a line along it in either
+    // direction, split where it goes through their sides. Splitting the
+    // lines on several threads at once must still leave the points of each
+    // in order along it.
+    SS.chordTolCalculated = 0.02;
+    SS.maxSegments = 10;
+    RgbaColor color = RgbaColor::From(100, 100, 100);
+    SShell cubes = {};
+    for(int i = 0; i < 20; i++) {
+        SBezierLoopSet square = Square(2*i + 0.5, -0.5, 2*i + 1.5, 0.5);
+        SShell cube = {}, row = {};
+        cube.MakeFromExtrusionOf(&square, Vector::From(0, 0, -0.5), Vector::From(0, 0, 0.5),
+                                 color);
+        square.Clear();
+        row.MakeFromAssemblyOf(&cubes, &cube);
+        cubes.Clear();
+        cube.Clear();
+        cubes = row;
+    }
+    cubes.MakeClassifyingBsps(NULL);
+
+    SSurface srfA = SSurface::FromPlane(Vector::From(0, 0, 0), Vector::From(1, 0, 0),
+                                        Vector::From(0, 1, 0)),
+             srfB = SSurface::FromPlane(Vector::From(0, 0, 0), Vector::From(1, 0, 0),
+                                        Vector::From(0, 0, 1));
+    SCurve lines[2] = {};
+    for(int d = 0; d < 2; d++) {
+        SCurvePt a = {}, b = {};
+        a.p = Vector::From(d ? 41 : -1, 0, 0);
+        b.p = Vector::From(d ? -1 : 41, 0, 0);
+        lines[d].pts.Add(&a);
+        lines[d].pts.Add(&b);
+    }
+
+    ThreadPool pool(3);
+    std::atomic<int> inOrder(0);
+    const int n = 20000;
+    pool.ParallelFor(n, [&](int i) {
+        int d = i % 2;
+        SCurve split = lines[d].MakeCopySplitAgainst(&cubes, NULL, &srfA, &srfB);
+        bool ok = (split.pts.n == 42);
+        for(int j = 1; ok && j < split.pts.n; j++) {
+            double dx = split.pts.elem[j].p.x - split.pts.elem[j - 1].p.x;
+            if(d ? (dx >= 0) : (dx <= 0)) ok = false;
+        }
+        split.Clear();
+        FreeAllTemporary();
+        if(ok) inOrder++;
+    });
+    CHECK_TRUE(inOrder == n);
+
+    for(int d = 0; d < 2; d++) {
+        lines[d].Clear();
+    }
+    cubes.CleanupAfterBoolean();
+    cubes.Clear();
+    SBspUv::ForgetUnused();
+    SBspUv::ForgetUnused();
+}
+
+// Union copies of a block along x in pairs, and those pairs in pairs, as a
+// step and repeat group does; each round's pairs on the pool at once.
+static void UnionInPairs(ThreadPool *pool, SShell *out, int count) {
+    SBezierLoopSet square = Square(0, 0, 2, 2);
+    SShell block = {};
+    block.MakeFromExtrusionOf(&square, Vector::From(0, 0, 0), Vector::From(0, 0, 2),
+                              RgbaColor::From(100, 100, 100));
+    square.Clear();
+    std::vector<SShell> copies(count);
+    for(int i = 0; i < count; i++) {
+        copies[i] = {};
+        copies[i].MakeFromTransformationOf(&block, Vector::From(1.5*i, 0.25*i, 0.25*i),
+                                           Quaternion::IDENTITY, 1.0);
+    }
+    block.Clear();
+    while(copies.size() > 1) {
+        std::vector<SShell> combined(copies.size() / 2);
+        pool->ParallelFor((int)combined.size(), [&](int i) {
+            TempScope scope;
+            combined[i] = {};
+            combined[i].MakeFromUnionOf(&copies[2*i], &copies[2*i + 1]);
+            copies[2*i].Clear();
+            copies[2*i + 1].Clear();
+        });
+        if(copies.size() % 2 != 0) {
+            combined.push_back(copies.back());
+        }
+        copies = std::move(combined);
+    }
+    *out = copies[0];
+}
+
+TEST_CASE(union_in_pairs_in_parallel) {
+    // Whole Booleans at once on several threads give just what they do
+    // one at a time.
+    SS.chordTolCalculated = 0.02;
+    SS.maxSegments = 10;
+    ThreadPool serial(0), parallel(3);
+    SShell first = {};
+    UnionInPairs(&serial, &first, 16);
+    CHECK_FALSE(first.booleanFailed);
+    int same = 0;
+    for(int run = 0; run < 20; run++) {
+        SShell again = {};
+        UnionInPairs(&parallel, &again, 16);
+        if(!again.booleanFailed && SameShell(&first, &again)) same++;
+        again.Clear();
+    }
+    CHECK_TRUE(same == 20);
+    first.Clear();
+}
@@ -110,3 +110,95 @@ TEST_CASE(errors) {
   CHECK_PARSE_ERR("(",
                   "Expected ')'");
 }
+
+TEST_CASE(program) {
+  Param px = {}, py = {};
+  px.val = 3;
+  py.val = 5;
+  Expr *x = Expr::AllocExpr();
+  x->op = Expr::Op::PARAM_PTR;
+  x->parp = &px;
+  Expr *y = Expr::AllocExpr();
+  y->op = Expr::Op::PARAM_PTR;
+  y->parp = &py;
+
+  ExprProgram prog;
+  // x*y and y*x are the same value, so they're only computed once.
+  Expr *e = (x->Times(y))->Plus(y->Times(x));
+  int r = prog.Add(e);
+  CHECK_TRUE(prog.Size() == 4);
+  // And the constants are folded, even in an expression that wasn't built
+  // with AnyOp().
+  Expr *k = Expr::AllocExpr();
+  k->op = Expr::Op::TIMES;
+  k->a = Expr::From(2.0);
+  k->b = Expr::From(4.0);
+  int s = prog.Add(k->Minus(x->Times(y)));
+  CHECK_TRUE(prog.Size() == 8);
+
+  prog.Eval();
+  CHECK_TRUE(prog.reg[r] == 30);
+  CHECK_TRUE(prog.reg[s] == -7);
+  px.val = 1;
+  prog.Eval();
+  CHECK_TRUE(prog.reg[r] == 10);
+  CHECK_TRUE(prog.reg[s] == 3);
+}
+
+TEST_CASE(shared) {
+  hParam hx = { 100 }, hy = { 101 };
+  Expr *x = Expr::From(hx), *y = Expr::From(hy);
+  CHECK_TRUE(Expr::From(hx) == x);
+  CHECK_TRUE(x->Plus(y)->Sqrt() == x->Plus(y)->Sqrt());
+  CHECK_TRUE(x->Plus(y) != y->Plus(x));
+}
+
+TEST_CASE(simplify) {
+  hParam hx = { 100 }, hy = { 101 };
+  Expr *x = Expr::From(hx), *y = Expr::From(hy);
+  CHECK_TRUE(x->Times(Expr::From(1.0)) == x);
+  CHECK_TRUE(Expr::From(0.0)->Plus(x) == x);
+  CHECK_TRUE(x->Times(y)->Minus(x->Times(y))->IsConstant(0));
+  CHECK_TRUE(x->Negate()->Negate() == x);
+  CHECK_TRUE(Expr::From(2.0)->Times(Expr::From(3.0))->IsConstant(6));
+  // After substitution, x - y is y - y, which is zero.
+  CHECK_TRUE(x->Minus(y)->Substitute(hx, hy)->IsConstant(0));
+  CHECK_TRUE(x->Minus(y)->Substitute(hy, hy) == x->Minus(y));
+}
+
+TEST_CASE(substitute_all) {
+  hParam hx = { 100 }, hy = { 101 }, hz = { 102 };
+  Expr *x = Expr::From(hx), *y = Expr::From(hy), *z = Expr::From(hz);
+  std::unordered_map<uint32_t, hParam> subst = { { hx.v, hz }, { hy.v, hz } };
+  std::unordered_map<const Expr *, Expr *> memo;
+  Expr *e = x->Plus(y)->Times(x->Plus(y));
+  CHECK_TRUE(e->Substitute(subst, &memo) == z->Plus(z)->Times(z->Plus(z)));
+  CHECK_TRUE(x->Minus(y)->Substitute(subst, &memo)->IsConstant(0));
+  CHECK_TRUE(z->Sqrt()->Substitute(subst, &memo) == z->Sqrt());
+}
+
+TEST_CASE(gradient) {
+  Param px = {}, py = {};
+  px.val = 3;
+  py.val = 5;
+  Expr *x = Expr::AllocExpr();
+  x->op = Expr::Op::PARAM_PTR;
+  x->parp = &px;
+  Expr *y = Expr::AllocExpr();
+  y->op = Expr::Op::PARAM_PTR;
+  y->parp = &py;
+
+  ExprProgram prog;
+  // f = x*y + sin(x)/y + sqrt(x*x)
+  Expr *f = (x->Times(y))->Plus((x->Sin())->Div(y))->Plus((x->Square())->Sqrt());
+  int r = prog.Add(f);
+  std::vector<int> deps;
+  prog.Dependencies(r, &deps);
+  CHECK_TRUE(std::is_sorted(deps.begin(), deps.end()));
+
+  prog.Eval();
+  prog.Gradient(r, deps.data(), (int)deps.size());
+  int rx = prog.Add(x), ry = prog.Add(y);
+  CHECK_EQ_EPS(prog.adj[rx], 5 + cos(3.0)/5 + 1);
+  CHECK_EQ_EPS(prog.adj[ry], 3 - sin(3.0)/25);
+}
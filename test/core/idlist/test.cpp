@@ -0,0 +1,79 @@
+#include "harness.h"
+
+static bool IsSorted(ParamList *l) {
+    for(int i = 1; i < l->n; i++) {
+        if(l->elem[i - 1].h.v >= l->elem[i].h.v) return false;
+    }
+    return true;
+}
+
+TEST_CASE(add_and_find) {
+    ParamList l = {};
+    // Both in order and out of order, and across the size where the list
+    // starts to be indexed.
+    for(uint32_t v = 1; v <= 100; v++) {
+        Param p = {};
+        p.h.v = (v % 2) ? v : 1000 - v;
+        p.val = v;
+        l.Add(&p);
+    }
+    CHECK_TRUE(l.n == 100);
+    CHECK_TRUE(IsSorted(&l));
+    for(int i = 0; i < l.n; i++) {
+        CHECK_TRUE(l.IndexOf(l.elem[i].h) == i);
+    }
+    CHECK_EQ_EPS(l.FindById(hParam { 7 })->val, 7);
+    CHECK_EQ_EPS(l.FindById(hParam { 1000 - 8 })->val, 8);
+    CHECK_TRUE(l.FindByIdNoOops(hParam { 8 }) == NULL);
+    CHECK_TRUE(l.FindByIdNoOops(hParam { 5000 }) == NULL);
+    l.Clear();
+}
+
+TEST_CASE(remove) {
+    ParamList l = {};
+    for(uint32_t v = 1; v <= 50; v++) {
+        Param p = {};
+        p.h.v = v;
+        l.Add(&p);
+    }
+    for(Param &p : l) {
+        p.tag = (p.h.v % 3 == 0) ? 1 : 0;
+    }
+    l.RemoveTagged();
+    CHECK_TRUE(l.n == 34);
+    CHECK_TRUE(l.FindByIdNoOops(hParam { 3 }) == NULL);
+    CHECK_TRUE(l.FindById(hParam { 49 })->h.v == 49);
+
+    ParamList m = {};
+    l.MoveSelfInto(&m);
+    CHECK_TRUE(l.FindByIdNoOops(hParam { 49 }) == NULL);
+    CHECK_TRUE(m.FindById(hParam { 49 })->h.v == 49);
+    m.Clear();
+}
+
+TEST_CASE(add_unsorted) {
+    ParamList l = {};
+    for(uint32_t v = 1; v <= 20; v++) {
+        Param p = {};
+        p.h.v = 2 * v;
+        l.Add(&p);
+    }
+    for(uint32_t v = 40; v >= 1; v--) {
+        if(v % 2 == 0) continue;
+        Param p = {};
+        p.h.v = v;
+        p.val = v;
+        l.AddUnsorted(&p);
+    }
+    // Nothing can be looked up until it's sorted again.
+    CHECK_TRUE(l.unsorted);
+    l.Sort();
+    CHECK_FALSE(l.unsorted);
+    CHECK_TRUE(l.n == 40);
+    CHECK_TRUE(IsSorted(&l));
+    for(int i = 0; i < l.n; i++) {
+        CHECK_TRUE(l.IndexOf(l.elem[i].h) == i);
+    }
+    CHECK_EQ_EPS(l.FindById(hParam { 17 })->val, 17);
+    l.Clear();
+}
@@ -0,0 +1,433 @@
+#include "harness.h"
+
+// A sketch in the XY plane, written straight in to SK like the library does,
+// so that the solver can be tested without any requests or groups to
+// generate it from. Everything but the workplane is in the group solved.
+class TestSketch {
+public:
+    Group                   g = {};
+    hEntity                 wrkpl = {};
+    System                  sys = {};
+    std::vector<hParam>     unknown;
+    std::vector<hParam>     dragged;
+    int                     dof = 0;
+    List<hConstraint>       bad = {};
+
+    TestSketch() {
+        g.h.v = 2;
+        hParam o[3] = { AddParam(0, false), AddParam(0, false), AddParam(0, false) };
+        Entity origin = {};
+        origin.type = Entity::Type::POINT_IN_3D;
+        origin.group.v = 1;
+        for(int i = 0; i < 3; i++) origin.param[i] = o[i];
+        hEntity ho = AddEntity(&origin);
+
+        hParam q[4] = { AddParam(1, false), AddParam(0, false),
+                        AddParam(0, false), AddParam(0, false) };
+        Entity normal = {};
+        normal.type = Entity::Type::NORMAL_IN_3D;
+        normal.group.v = 1;
+        for(int i = 0; i < 4; i++) normal.param[i] = q[i];
+        hEntity hn = AddEntity(&normal);
+
+        Entity w = {};
+        w.type = Entity::Type::WORKPLANE;
+        w.group.v = 1;
+        w.point[0] = ho;
+        w.normal = hn;
+        wrkpl = AddEntity(&w);
+    }
+
+    ~TestSketch() {
+        bad.Clear();
+        sys.Clear();
+    }
+
+    hParam AddParam(double val, bool isUnknown = true) {
+        Param p = {};
+        p.h.v = (uint32_t)SK.param.n + 1;
+        p.val = val;
+        SK.param.Add(&p);
+        if(isUnknown) unknown.push_back(p.h);
+        return p.h;
+    }
+
+    hEntity AddEntity(Entity *e) {
+        e->h.v = (uint32_t)SK.entity.n + 1;
+        SK.entity.Add(e);
+        return e->h;
+    }
+
+    hEntity AddPoint(double x, double y) {
+        Entity e = {};
+        e.type = Entity::Type::POINT_IN_2D;
+        e.group = g.h;
+        e.workplane = wrkpl;
+        e.param[0] = AddParam(x);
+        e.param[1] = AddParam(y);
+        return AddEntity(&e);
+    }
+
+    hEntity AddLine(hEntity a, hEntity b) {
+        Entity e = {};
+        e.type = Entity::Type::LINE_SEGMENT;
+        e.group = g.h;
+        e.workplane = wrkpl;
+        e.point[0] = a;
+        e.point[1] = b;
+        return AddEntity(&e);
+    }
+
+    hConstraint AddConstraint(Constraint::Type type, hEntity ptA, hEntity ptB,
+                              hEntity entityA, hEntity entityB, double valA = 0) {
+        Constraint c = {};
+        c.h.v = (uint32_t)SK.constraint.n + 1;
+        c.type = type;
+        c.group = g.h;
+        c.workplane = wrkpl;
+        c.ptA = ptA;
+        c.ptB = ptB;
+        c.entityA = entityA;
+        c.entityB = entityB;
+        c.valA = valA;
+
+        // Some constraints have unknowns of their own.
+        IdList<Param,hParam> params = {};
+        c.Generate(&params);
+        for(Param &p : params) {
+            SK.param.Add(&p);
+            unknown.push_back(p.h);
+        }
+        params.Clear();
+
+        SK.constraint.Add(&c);
+        return c.h;
+    }
+
+    // Take a coordinate of a point out of the unknowns, so that it stays put.
+    void Fix(hEntity pt, int i) {
+        hParam hp = SK.GetEntity(pt)->param[i];
+        unknown.erase(std::remove_if(unknown.begin(), unknown.end(),
+                                     [&](hParam u) { return u.v == hp.v; }),
+                      unknown.end());
+    }
+
+    void Drag(hEntity pt) {
+        EntityBase *e = SK.GetEntity(pt);
+        dragged = { e->param[0], e->param[1] };
+    }
+
+    // Write the system for the group from the sketch, as
+    // SolveSpaceUI::WriteEqSystemForGroup() does.
+    void WriteSystem() {
+        sys.param.Clear();
+        sys.eq.Clear();
+        sys.dragged.Clear();
+        for(hParam hp : unknown) {
+            Param p = {};
+            p.h = hp;
+            p.val = SK.GetParam(hp)->val;
+            sys.param.Add(&p);
+        }
+        for(hParam hp : dragged) {
+            sys.dragged.Add(&hp);
+        }
+    }
+
+    SolveResult Solve(bool forceDofCheck = false, bool andFindFree = false) {
+        WriteSystem();
+        bad.Clear();
+        SolveResult how = sys.Solve(&g, &dof, &bad, /*andFindBad=*/true,
+                                    andFindFree, forceDofCheck);
+        FreeAllTemporary();
+        return how;
+    }
+
+    // Find the constraints that could each be removed to fix a redundant
+    // sketch the slow way, by taking out each one in turn and testing the
+    // rank of what's left; in the same order that Solve() lists them.
+    std::vector<hConstraint> FindRemovableByRetesting(bool forceDofCheck = false) {
+        std::vector<hConstraint> removable;
+        for(int a = 0; a < 2; a++) {
+            for(int i = 0; i < SK.constraint.n; i++) {
+                ConstraintBase *c = &(SK.constraint.elem[i]);
+                if((c->type == Constraint::Type::POINTS_COINCIDENT) != (a == 1)) continue;
+
+                c->group.v = g.h.v + 1;
+                WriteSystem();
+                SolveResult how = sys.SolveRank(&g, NULL, NULL, false, false,
+                                                forceDofCheck);
+                FreeAllTemporary();
+                c = &(SK.constraint.elem[i]);
+                c->group = g.h;
+                if(how == SolveResult::OKAY) removable.push_back(c->h);
+            }
+        }
+        return removable;
+    }
+
+    bool BadIs(const std::vector<hConstraint> &expected) {
+        if(bad.n != (int)expected.size()) return false;
+        for(int i = 0; i < bad.n; i++) {
+            if(bad.elem[i].v != expected[i].v) return false;
+        }
+        return true;
+    }
+
+    double Coord(hEntity pt, int i) {
+        return SK.GetParam(SK.GetEntity(pt)->param[i])->val;
+    }
+
+    void SetCoord(hEntity pt, int i, double val) {
+        SK.GetParam(SK.GetEntity(pt)->param[i])->val = val;
+    }
+
+    bool IsFree(hEntity pt, int i) {
+        return SK.GetParam(SK.GetEntity(pt)->param[i])->free;
+    }
+};
+
+TEST_CASE(duplicate_constraints) {
+    // Constraints that say the same thing again, like horizontal three times
+    // over, are satisfied along with the first; they're not redundant.
+    TestSketch s;
+    hEntity a = s.AddPoint(0, 0), b = s.AddPoint(10, 1),
+            c = s.AddPoint(3, 4), d = s.AddPoint(5, 5);
+    hEntity l = s.AddLine(a, b);
+    for(int i = 0; i < 3; i++) {
+        s.AddConstraint(Constraint::Type::HORIZONTAL, {}, {}, l, {});
+    }
+    s.AddConstraint(Constraint::Type::POINTS_COINCIDENT, c, d, {}, {});
+    s.AddConstraint(Constraint::Type::POINTS_COINCIDENT, d, c, {}, {});
+    CHECK_TRUE(s.Solve() == SolveResult::OKAY);
+    CHECK_TRUE(s.bad.n == 0);
+    CHECK_TRUE(s.dof == 5);
+    CHECK_EQ_EPS(s.Coord(a, 1), s.Coord(b, 1));
+    CHECK_EQ_EPS(s.Coord(c, 0), s.Coord(d, 0));
+
+    // But without the substitutions, as when the degrees of freedom are
+    // checked, they're as redundant as any others.
+    CHECK_TRUE(s.Solve(/*forceDofCheck=*/true) == SolveResult::REDUNDANT_OKAY);
+}
+
+TEST_CASE(redundant_constraints) {
+    // The parallel constraint and the two horizontal ones say the same thing
+    // between them, so removing any one of those fixes it; except that the
+    // first line is horizontal twice over, so that's still there without
+    // either of those.
+    TestSketch s;
+    hEntity a = s.AddPoint(0, 0), b = s.AddPoint(10, 1),
+            c = s.AddPoint(0, 5), d = s.AddPoint(10, 7);
+    hEntity ab = s.AddLine(a, b), cd = s.AddLine(c, d);
+    s.AddConstraint(Constraint::Type::HORIZONTAL, {}, {}, ab, {});
+    s.AddConstraint(Constraint::Type::HORIZONTAL, {}, {}, ab, {});
+    hConstraint par = s.AddConstraint(Constraint::Type::PARALLEL, {}, {}, ab, cd);
+    hConstraint hcd = s.AddConstraint(Constraint::Type::HORIZONTAL, {}, {}, cd, {});
+    s.AddConstraint(Constraint::Type::PT_PT_DISTANCE, a, b, {}, {}, 10);
+    s.AddConstraint(Constraint::Type::PT_PT_DISTANCE, c, d, {}, {}, 10);
+    CHECK_TRUE(s.Solve() == SolveResult::REDUNDANT_OKAY);
+    CHECK_TRUE(s.BadIs({ par, hcd }));
+    CHECK_TRUE(s.BadIs(s.FindRemovableByRetesting()));
+
+    // Without the substitutions, the first line being horizontal twice is
+    // redundant too, so no one constraint fixes it.
+    CHECK_TRUE(s.Solve(/*forceDofCheck=*/true) == SolveResult::REDUNDANT_OKAY);
+    CHECK_TRUE(s.bad.n == 0);
+    CHECK_TRUE(s.BadIs(s.FindRemovableByRetesting(/*forceDofCheck=*/true)));
+}
+
+TEST_CASE(redundant_constraints_match_retesting) {
+    // A right triangle with all three sides given, and a point made
+    // coincident with a corner in a loop; the loop is fine, since those are
+    // all substituted, but the sides and the right angle are one too many.
+    TestSketch s;
+    hEntity a = s.AddPoint(0, 0), b = s.AddPoint(3, 0.5), c = s.AddPoint(0.5, 4),
+            d = s.AddPoint(1, 1), e = s.AddPoint(2, 2);
+    hEntity ab = s.AddLine(a, b), ca = s.AddLine(c, a);
+    hConstraint c1 = s.AddConstraint(Constraint::Type::PT_PT_DISTANCE, a, b, {}, {}, 3),
+                c2 = s.AddConstraint(Constraint::Type::PT_PT_DISTANCE, b, c, {}, {}, 5),
+                c3 = s.AddConstraint(Constraint::Type::PT_PT_DISTANCE, c, a, {}, {}, 4);
+    s.AddConstraint(Constraint::Type::HORIZONTAL, {}, {}, ab, {});
+    hConstraint c4 = s.AddConstraint(Constraint::Type::PERPENDICULAR, {}, {}, ab, ca);
+    s.AddConstraint(Constraint::Type::POINTS_COINCIDENT, d, e, {}, {});
+    s.AddConstraint(Constraint::Type::POINTS_COINCIDENT, e, a, {}, {});
+    s.AddConstraint(Constraint::Type::POINTS_COINCIDENT, a, d, {}, {});
+    CHECK_TRUE(s.Solve() == SolveResult::REDUNDANT_OKAY);
+    CHECK_TRUE(s.BadIs({ c1, c2, c3, c4 }));
+    CHECK_TRUE(s.BadIs(s.FindRemovableByRetesting()));
+
+    // Without the substitutions, the loop is redundant too.
+    CHECK_TRUE(s.Solve(/*forceDofCheck=*/true) == SolveResult::REDUNDANT_OKAY);
+    CHECK_TRUE(s.bad.n == 0);
+    CHECK_TRUE(s.BadIs(s.FindRemovableByRetesting(/*forceDofCheck=*/true)));
+}
+
+TEST_CASE(drag_leaves_other_subsystems) {
+    // Two triangles that share nothing, so they're solved as separate
+    // subsystems; dragging a corner of the first leaves the second exactly
+    // where it was, whether or not the free unknowns are found too.
+    TestSketch s;
+    hEntity a = s.AddPoint(1, 1), b = s.AddPoint(10, 1), c = s.AddPoint(5, 5),
+            d = s.AddPoint(-1, -1), e = s.AddPoint(-10, -1), f = s.AddPoint(-5, -5);
+    hEntity o = SK.GetEntity(s.wrkpl)->point[0];
+    s.AddConstraint(Constraint::Type::POINTS_COINCIDENT, a, o, {}, {});
+    s.AddConstraint(Constraint::Type::PT_PT_DISTANCE, a, b, {}, {}, 10);
+    s.AddConstraint(Constraint::Type::PT_PT_DISTANCE, b, c, {}, {}, 8);
+    s.AddConstraint(Constraint::Type::PT_PT_DISTANCE, d, e, {}, {}, 10);
+    s.AddConstraint(Constraint::Type::PT_PT_DISTANCE, e, f, {}, {}, 8);
+    s.AddConstraint(Constraint::Type::PT_PT_DISTANCE, f, d, {}, {}, 6);
+
+    // Which unknowns are dragged changes the substitutions, so the first
+    // solve with the drag is a fresh one.
+    s.Drag(c);
+    CHECK_TRUE(s.Solve(/*forceDofCheck=*/false, /*andFindFree=*/true) == SolveResult::OKAY);
+    CHECK_TRUE(s.dof == 5);
+
+    hEntity other[] = { d, e, f };
+    double before[3][2];
+    for(int i = 0; i < 3; i++) {
+        before[i][0] = s.Coord(other[i], 0);
+        before[i][1] = s.Coord(other[i], 1);
+    }
+
+    for(bool andFindFree : { true, false }) {
+        s.SetCoord(c, 0, andFindFree ? 2 : -3);
+        s.SetCoord(c, 1, 9);
+        CHECK_TRUE(s.Solve(/*forceDofCheck=*/false, andFindFree) == SolveResult::OKAY);
+        CHECK_TRUE(s.dof == 5);
+        for(int i = 0; i < 3; i++) {
+            CHECK_TRUE(s.Coord(other[i], 0) == before[i][0]);
+            CHECK_TRUE(s.Coord(other[i], 1) == before[i][1]);
+        }
+    }
+
+    // The corner on the origin isn't free, but all else is, even in the
+    // triangle that was left as it was.
+    s.Solve(/*forceDofCheck=*/false, /*andFindFree=*/true);
+    CHECK_TRUE(!s.IsFree(a, 0) && !s.IsFree(a, 1));
+    CHECK_TRUE(s.IsFree(b, 0) && s.IsFree(c, 1) && s.IsFree(d, 0) && s.IsFree(f, 1));
+}
+
+TEST_CASE(structure_reused_for_same_equations) {
+    // A triangle with its sides given; solving it again from somewhere else
+    // writes just the same equations, so the structure's reused, with the
+    // same compiled Jacobian.
+    TestSketch s;
+    hEntity a = s.AddPoint(1, 1), b = s.AddPoint(10, 1), c = s.AddPoint(5, 5);
+    hEntity o = SK.GetEntity(s.wrkpl)->point[0];
+    hEntity ab = s.AddLine(a, b);
+    s.AddConstraint(Constraint::Type::POINTS_COINCIDENT, a, o, {}, {});
+    s.AddConstraint(Constraint::Type::HORIZONTAL, {}, {}, ab, {});
+    s.AddConstraint(Constraint::Type::PT_PT_DISTANCE, a, b, {}, {}, 10);
+    hConstraint bc = s.AddConstraint(Constraint::Type::PT_PT_DISTANCE, b, c, {}, {}, 8);
+    s.AddConstraint(Constraint::Type::PT_PT_DISTANCE, c, a, {}, {}, 6);
+    CHECK_TRUE(s.Solve() == SolveResult::OKAY);
+    CHECK_TRUE(!s.sys.subsys.empty());
+    uint64_t key = s.sys.structure.key;
+    const void *jacobian = s.sys.subsys[0].mat.A.col.data();
+
+    // Start from the other side of the base, so that it flips over.
+    s.SetCoord(c, 1, -5);
+    CHECK_TRUE(s.Solve() == SolveResult::OKAY);
+    CHECK_TRUE(s.sys.structure.key == key);
+    CHECK_TRUE(s.sys.subsys[0].mat.A.col.data() == jacobian);
+    CHECK_EQ_EPS(s.Coord(b, 0), 10);
+    CHECK_EQ_EPS(s.Coord(c, 0), 3.6);
+    CHECK_EQ_EPS(s.Coord(c, 1), -4.8);
+
+    // But a new dimension changes the equations, so that's written afresh.
+    SK.GetConstraint(bc)->valA = 6;
+    CHECK_TRUE(s.Solve() == SolveResult::OKAY);
+    CHECK_TRUE(s.sys.structure.key != key);
+    CHECK_EQ_EPS(s.Coord(c, 0), 5);
+    CHECK_EQ_EPS(s.Coord(c, 1), -sqrt(11));
+}
+
+TEST_CASE(structure_not_reused_for_other_inputs) {
+    // Even with the same key, as if the hash collided, a structure that was
+    // written from different equations isn't reused.
+    TestSketch s;
+    hEntity a = s.AddPoint(0, 0), b = s.AddPoint(10, 1);
+    hEntity ab = s.AddLine(a, b);
+    s.AddConstraint(Constraint::Type::HORIZONTAL, {}, {}, ab, {});
+    hConstraint d = s.AddConstraint(Constraint::Type::PT_PT_DISTANCE, a, b, {}, {}, 10);
+    CHECK_TRUE(s.Solve() == SolveResult::OKAY);
+    std::vector<uint64_t> before = s.sys.structure.inputs;
+
+    SK.GetConstraint(d)->valA = 5;
+    CHECK_TRUE(s.Solve() == SolveResult::OKAY);
+    CHECK_TRUE(s.sys.structure.inputs != before);
+    std::vector<uint64_t> after = s.sys.structure.inputs;
+
+    s.sys.structure.inputs = before;
+    s.SetCoord(b, 0, 20);
+    CHECK_TRUE(s.Solve() == SolveResult::OKAY);
+    CHECK_TRUE(s.sys.structure.inputs == after);
+    CHECK_EQ_EPS(s.Coord(b, 0) - s.Coord(a, 0), 5);
+}
+
+TEST_CASE(structure_kept_for_each_group) {
+    // Solving another group in between keeps this group's structure, until
+    // this group's gone from the sketch.
+    TestSketch s;
+    hEntity a = s.AddPoint(0, 0), b = s.AddPoint(10, 1);
+    hEntity ab = s.AddLine(a, b);
+    s.AddConstraint(Constraint::Type::HORIZONTAL, {}, {}, ab, {});
+    s.AddConstraint(Constraint::Type::PT_PT_DISTANCE, a, b, {}, {}, 10);
+    CHECK_TRUE(s.Solve() == SolveResult::OKAY);
+    uint64_t key = s.sys.structure.key;
+
+    // None of the constraints are in group 3.
+    s.g.h.v = 3;
+    CHECK_TRUE(s.Solve() == SolveResult::OKAY);
+    CHECK_TRUE(s.dof == 4);
+    CHECK_TRUE(s.sys.savedStructure.count(2) == 1);
+    s.g.h.v = 2;
+    s.SetCoord(b, 0, -5);
+    CHECK_TRUE(s.Solve() == SolveResult::OKAY);
+    CHECK_TRUE(s.sys.structure.key == key);
+    CHECK_TRUE(s.sys.savedStructure.count(2) == 0);
+    CHECK_TRUE(s.sys.savedStructure.count(3) == 1);
+    CHECK_EQ_EPS(s.Coord(b, 0) - s.Coord(a, 0), -10);
+
+    // Group 3 isn't in the sketch, so its structure's forgotten; and then
+    // group 2's too, once that's deleted.
+    Group g = {};
+    g.h.v = 2;
+    SK.group.Add(&g);
+    s.sys.ForgetDeletedGroups();
+    CHECK_TRUE(s.sys.savedStructure.empty());
+    CHECK_TRUE(s.sys.structure.key == key);
+    SK.group.RemoveById(g.h);
+    s.sys.ForgetDeletedGroups();
+    CHECK_TRUE(s.sys.structure.key == 0);
+    CHECK_TRUE(s.sys.subsys.empty());
+    CHECK_TRUE(s.Solve() == SolveResult::OKAY);
+    CHECK_TRUE(s.sys.structure.key == key);
+}
+
+TEST_CASE(damped_when_newton_fails) {
+    // A line from the origin at 60 degrees to the x axis, with just the
+    // height of its end unknown. From well above that, the direction cosine
+    // is nearly flat, so Newton's method overshoots, further each time; but
+    // the damped steps get there, on one side or the other.
+    TestSketch s;
+    hEntity a = s.AddPoint(0, 0), b = s.AddPoint(10, 0), c = s.AddPoint(1, 10);
+    s.Fix(a, 0);
+    s.Fix(a, 1);
+    s.Fix(b, 0);
+    s.Fix(b, 1);
+    s.Fix(c, 0);
+    hEntity ab = s.AddLine(a, b), ac = s.AddLine(a, c);
+    s.AddConstraint(Constraint::Type::ANGLE, {}, {}, ab, ac, 60);
+    CHECK_TRUE(s.Solve() == SolveResult::OKAY);
+    CHECK_TRUE(s.sys.alone.size() == 1);
+    CHECK_TRUE(s.sys.alone[0].mat.damped);
+    CHECK_EQ_EPS(fabs(s.Coord(c, 1)), sqrt(3));
+
+    // But from close by, that's not needed.
+    s.SetCoord(c, 1, 2);
+    CHECK_TRUE(s.Solve() == SolveResult::OKAY);
+    CHECK_TRUE(!s.sys.alone[0].mat.damped);
+    CHECK_EQ_EPS(s.Coord(c, 1), sqrt(3));
+}
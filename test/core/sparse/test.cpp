@@ -0,0 +1,102 @@
+#include "harness.h"
+
+static SparseSymmetricMatrix MakeMatrix(int n, std::vector<std::vector<double>> lower) {
+    SparseSymmetricMatrix m = {};
+    m.n = n;
+    for(int i = 0; i < n; i++) {
+        m.rowStart.push_back((int)m.col.size());
+        for(int j = 0; j <= i; j++) {
+            if(lower[i][j] == 0 && i != j) continue;
+            m.col.push_back(j);
+            m.val.push_back(lower[i][j]);
+        }
+    }
+    m.rowStart.push_back((int)m.col.size());
+    m.Analyze();
+    return m;
+}
+
+TEST_CASE(solve) {
+    SparseSymmetricMatrix m = MakeMatrix(3, {
+        { 4 },
+        { 0, 9 },
+        { 2, 0, 3 },
+    });
+    m.Factor(1e-20);
+    CHECK_TRUE(m.zeroPivots == 0);
+    double x[3] = { 10, 18, 11 };
+    m.Solve(x);
+    CHECK_EQ_EPS(x[0], 1);
+    CHECK_EQ_EPS(x[1], 2);
+    CHECK_EQ_EPS(x[2], 3);
+}
+
+TEST_CASE(rank_deficient) {
+    // The Gram matrix of the rows (1 0 0), (1 1 0) and (2 1 0); the last row
+    // is the sum of the first two.
+    SparseSymmetricMatrix m = MakeMatrix(3, {
+        { 1 },
+        { 1, 2 },
+        { 2, 3, 5 },
+    });
+    m.Factor(1e-8);
+    CHECK_TRUE(m.zeroPivots == 1);
+    CHECK_TRUE(m.d[2] == 0);
+}
+
+TEST_CASE(inverse_quadratic_form) {
+    SparseSymmetricMatrix m = MakeMatrix(3, {
+        { 4 },
+        { 0, 9 },
+        { 2, 0, 3 },
+    });
+    m.Factor(1e-20);
+    // x'*inverse(M)*x = x'*y for M*y = x, and M*(1 2 3)' = (10 18 11)'.
+    CHECK_EQ_EPS(m.InverseQuadraticForm({ 0, 1, 2 }, { 10, 18, 11 }), 10 + 36 + 33);
+    // A single entry reaches only its ancestors in the elimination tree;
+    // and the scratch space is left clean for the next call.
+    CHECK_EQ_EPS(m.InverseQuadraticForm({ 1 }, { 3 }), 1);
+    CHECK_EQ_EPS(m.InverseQuadraticForm({ 1 }, { 3 }), 1);
+}
+
+TEST_CASE(null_vector) {
+    // As above, the last row is the sum of the first two, so the null space
+    // is along (-1 -1 1).
+    SparseSymmetricMatrix m = MakeMatrix(3, {
+        { 1 },
+        { 1, 2 },
+        { 2, 3, 5 },
+    });
+    m.Factor(1e-8);
+    double y[3];
+    m.NullVector(2, y);
+    CHECK_EQ_EPS(y[0], -1);
+    CHECK_EQ_EPS(y[1], -1);
+    CHECK_EQ_EPS(y[2], 1);
+}
+
+TEST_CASE(nan_pivot) {
+    // A degenerate equation, like a point-line distance to a line of zero
+    // length, can have partials that aren't a number; that row is dropped
+    // like any other that's all zeros, and the rows after it are unaffected.
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    SparseSymmetricMatrix m = MakeMatrix(3, {
+        { 4 },
+        { nan, nan },
+        { 2, nan, 3 },
+    });
+    m.Factor(1e-8);
+    CHECK_TRUE(m.zeroPivots == 1);
+    CHECK_TRUE(m.d[1] == 0);
+    CHECK_EQ_EPS(m.d[2], 2);
+    double x[3] = { 10, 1, 11 };
+    m.Solve(x);
+    CHECK_EQ_EPS(x[0], 1);
+    CHECK_EQ_EPS(x[1], 0);
+    CHECK_EQ_EPS(x[2], 3);
+    double y[3];
+    m.NullVector(1, y);
+    CHECK_EQ_EPS(y[0], 0);
+    CHECK_EQ_EPS(y[1], 1);
+    CHECK_EQ_EPS(y[2], 0);
+}
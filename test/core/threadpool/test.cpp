@@ -0,0 +1,64 @@
+#include "harness.h"
+
+TEST_CASE(parallel_for) {
+    ThreadPool pool(3);
+    std::vector<int> calls(1000, 0);
+    pool.ParallelFor((int)calls.size(), [&](int i) {
+        calls[i]++;
+    });
+    CHECK_TRUE(std::count(calls.begin(), calls.end(), 1) == (int)calls.size());
+}
+
+TEST_CASE(nested) {
+    ThreadPool pool(3);
+    std::atomic<int> sum(0);
+    pool.ParallelFor(10, [&](int i) {
+        pool.ParallelFor(10, [&](int j) {
+            sum += i * 10 + j;
+        });
+    });
+    CHECK_TRUE(sum == 4950);
+}
+
+TEST_CASE(no_workers) {
+    ThreadPool pool(0);
+    std::vector<int> order;
+    pool.ParallelFor(3, [&](int i) {
+        order.push_back(i);
+    });
+    CHECK_TRUE(order == std::vector<int>({ 0, 1, 2 }));
+}
+
+TEST_CASE(temporary_heap) {
+    ThreadPool pool(3);
+    std::vector<double> values(100, 0);
+    pool.ParallelFor((int)values.size(), [&](int i) {
+        TempScope scope;
+        Expr *e = Expr::From((double)i);
+        for(int j = 0; j < 1000; j++) {
+            e = e->Plus(Expr::From((double)j));
+        }
+        values[i] = e->Eval();
+    });
+    for(int i = 0; i < (int)values.size(); i++) {
+        CHECK_EQ_EPS(values[i], i + 999 * 1000 / 2);
+    }
+}
+
+static int Recurse(int depth) {
+    volatile char frame[1024];
+    frame[0] = (char)depth;
+    if(depth == 0) return 0;
+    return Recurse(depth - 1) + 1 + (frame[0] - (char)depth);
+}
+
+TEST_CASE(deep_recursion) {
+    // The workers have as much stack as the main thread does, so deeply
+    // recursive code (like inserting into a BSP) can run on them.
+    ThreadPool pool(3);
+    std::atomic<int> done(0);
+    pool.ParallelFor(16, [&](int i) {
+        if(Recurse(4096) == 4096) done++;
+    });
+    CHECK_TRUE(done == 16);
+}
@@ -26,3 +26,57 @@ TEST_CASE(normal_inters) {
     // The assembly is supposed to interfere.
     CHECK_TRUE(inters);
 }
+
+static double ShellVolume(SShell *shell) {
+    SMesh m = {};
+    shell->TriangulateInto(&m);
+    double volume = 0;
+    for(const STriangle &tr : m.l) {
+        volume += tr.SignedVolume();
+    }
+    m.Clear();
+    return volume;
+}
+
+// Repeat the extrusion n times, each copy moved by twice the translation
+// from the one before it, as one-sided step and repeat does; and combine
+// the copies as a union instead of an assembly.
+static Group *StepAndRepeat(int n, Vector trans) {
+    Group *g = SK.GetGroup(SS.GW.activeGroup);
+    SK.GetGroup(g->opA)->meshCombine = Group::CombineAs::UNION;
+    g->valA = n;
+    SK.GetParam(g->h.param(0))->val = trans.x;
+    SK.GetParam(g->h.param(1))->val = trans.y;
+    SK.GetParam(g->h.param(2))->val = trans.z;
+    SS.GenerateAll(SolveSpaceUI::Generate::ALL);
+    return SK.GetGroup(SS.GW.activeGroup);
+}
+
+TEST_CASE(union_of_touching_copies) {
+    CHECK_LOAD("normal.slvs");
+    Group *g = StepAndRepeat(5, Vector::From(1, 0.5, 0.5));
+
+    // Each copy overlaps the one before it, and the boxes move diagonally,
+    // so each one adds its volume less the overlap with that one.
+    SShell *src = &SK.GetGroup(g->opA)->thisShell;
+    Vector max, min;
+    src->GetBounding(&max, &min);
+    Vector size = max.Minus(min),
+           over = size.Minus(Vector::From(2, 1, 1));
+    double one = ShellVolume(src),
+           overlap = over.x * over.y * over.z;
+    CHECK_TRUE(overlap > 0);
+    CHECK_FALSE(g->thisShell.booleanFailed);
+    CHECK_EQ_EPS(ShellVolume(&g->thisShell) / (5*one - 4*overlap), 1);
+}
+
+TEST_CASE(union_of_separate_copies) {
+    CHECK_LOAD("normal.slvs");
+    Group *g = StepAndRepeat(5, Vector::From(10, 0, 0));
+
+    // The copies don't touch, so they're just assembled, whole.
+    SShell *src = &SK.GetGroup(g->opA)->thisShell;
+    CHECK_FALSE(g->thisShell.booleanFailed);
+    CHECK_TRUE(g->thisShell.surface.n == 5*src->surface.n);
+    CHECK_EQ_EPS(ShellVolume(&g->thisShell) / ShellVolume(src), 5);
+}